@@ -1,17 +1,104 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
 #define _POSIX_C_SOURCE 200809L
 
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+#ifdef __linux__
+#include <sys/sendfile.h>
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+#endif
+#endif
+
+#define XFER_CHUNK ((off_t)1 << 30)
+#define MAP_WINDOW ((off_t)8 << 20)
+#define PREFETCH_DEPTH 8
+#define PREFETCH_BUF (128 * 1024)
+#define SMALL_FILE_MAX (64 * 1024)
+#define BATCH_ARENA (1024 * 1024)
+#ifdef IOV_MAX
+#define BATCH_IOV IOV_MAX
+#else
+#define BATCH_IOV 1024
+#endif
+#define IOBUF_DEFAULT (64 * 1024)
+#define IOBUF_AUTO_MAX (1024 * 1024)
+#define IOBUF_HUGE (2 * 1024 * 1024)
+#define IOBUF_MAX (256 * 1024 * 1024)
+
+typedef enum { XFER_COPY_FILE_RANGE, XFER_SPLICE, XFER_SENDFILE, XFER_MMAP } xfer_e;
+typedef enum { KCOPY_DONE, KCOPY_REFUSED, KCOPY_ERROR } kcopy_e;
+
+static const char *xfer_names[] = {
+    [XFER_COPY_FILE_RANGE] = "copy_file_range",
+    [XFER_SPLICE] = "splice",
+    [XFER_SENDFILE] = "sendfile",
+    [XFER_MMAP] = "mmap",
+};
+
+typedef struct {
+  uint8_t *p;
+  off_t off;
+  size_t len;
+} window_t;
+
+typedef struct {
+  uint8_t *p;
+  size_t len;
+  size_t map_len;
+} iobuf_t;
+
+typedef struct {
+  bool number;
+  bool number_nonblank;
+  bool squeeze;
+  bool visible;
+  bool show_ends;
+  bool show_tabs;
+  size_t line;
+  bool line_start;
+  bool gobble;
+  iobuf_t out;
+  size_t out_len;
+} cook_t;
+
+typedef struct {
+  iobuf_t arena;
+  size_t used;
+  int iovcnt;
+  struct iovec iov[BATCH_IOV];
+} batch_t;
+
+typedef struct {
+  bool debug;
+  mode_t out_mode;
+  cook_t *cook;
+  batch_t *batch;
+} flags_t;
 
 static void usage(void) {
-  dprintf(STDERR_FILENO, "Usage: mcat [file ...]\n");
+  dprintf(STDERR_FILENO, "Usage: mcat [-Dbenstv] [file ...]\n");
 }
 
 static void error_msg(const char *filename) {
@@ -37,22 +124,482 @@ static int write_all(int fd, const void *buf, size_t len) {
   return 0;
 }
 
-static int stream_copy(int infd, int outfd) {
-  uint8_t buf[64 * 1024];
+static size_t iobuf_env_size(void) {
+  const char *s = getenv("CORE_UTILS_BUFSIZE");
+  // strtoull would take "-1" and wrap it; only plain digits are a size
+  if (s == NULL || *s < '0' || *s > '9') return 0;
+
+  // out-of-range values saturate at ULLONG_MAX and are clamped below
+  char *end = NULL;
+  unsigned long long val = strtoull(s, &end, 10);
+  if (end == s) return 0;
+  unsigned shift = 0;
+  if (*end == 'k' || *end == 'K') {
+    shift = 10;
+    end++;
+  } else if (*end == 'm' || *end == 'M') {
+    shift = 20;
+    end++;
+  }
+  if (*end != '\0') return 0;
+  if (val > ((unsigned long long)IOBUF_MAX >> shift)) return IOBUF_MAX;
+  return (size_t)val << shift;
+}
+
+// CORE_UTILS_BUFSIZE wins when set; otherwise the buffer is sized from the
+// block size and pipe capacity of both ends. Pipes are only grown for an
+// explicit request, since they are shared with the rest of the pipeline.
+static size_t iobuf_size(int infd, int outfd) {
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t want = iobuf_env_size();
+  bool explicit_size = want != 0;
+  int fds[2] = {infd, outfd};
+
+  if (!explicit_size) {
+    want = IOBUF_DEFAULT;
+    for (size_t i = 0; i < 2; i++) {
+      struct stat st;
+      if (fstat(fds[i], &st) < 0) continue;
+      if (st.st_blksize > 0 && (size_t)st.st_blksize > want) want = (size_t)st.st_blksize;
+#ifdef F_GETPIPE_SZ
+      if (S_ISFIFO(st.st_mode)) {
+        int cap = fcntl(fds[i], F_GETPIPE_SZ);
+        if (cap > 0 && (size_t)cap > want) want = (size_t)cap;
+      }
+#endif
+    }
+    if (want > IOBUF_AUTO_MAX) want = IOBUF_AUTO_MAX;
+  }
+
+  if (want < page) want = page;
+  want = (want + page - 1) / page * page;
+
+#ifdef F_SETPIPE_SZ
+  if (explicit_size) {
+    for (size_t i = 0; i < 2; i++) {
+      struct stat st;
+      if (fstat(fds[i], &st) < 0 || !S_ISFIFO(st.st_mode)) continue;
+      int cap = fcntl(fds[i], F_GETPIPE_SZ);
+      if (cap > 0 && (size_t)cap < want) fcntl(fds[i], F_SETPIPE_SZ, (int)want);
+    }
+  }
+#endif
+  return want;
+}
+
+static int iobuf_alloc(iobuf_t *b, size_t len) {
+  b->len = len;
+  b->map_len = 0;
+#ifdef MAP_ANONYMOUS
+  if (len >= IOBUF_HUGE) {
+    size_t map_len = (len + IOBUF_HUGE - 1) / IOBUF_HUGE * IOBUF_HUGE;
+    uint8_t *raw = mmap(NULL, map_len + IOBUF_HUGE, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw != MAP_FAILED) {
+      size_t lead = (IOBUF_HUGE - (uintptr_t)raw % IOBUF_HUGE) % IOBUF_HUGE;
+      if (lead > 0) munmap(raw, lead);
+      munmap(raw + lead + map_len, IOBUF_HUGE - lead);
+      b->p = raw + lead;
+      b->map_len = map_len;
+#ifdef MADV_HUGEPAGE
+      madvise(b->p, b->map_len, MADV_HUGEPAGE);
+#endif
+      return 0;
+    }
+  }
+#endif
+  void *p = NULL;
+  int rc = posix_memalign(&p, (size_t)sysconf(_SC_PAGESIZE), len);
+  if (rc != 0) {
+    errno = rc;
+    return -1;
+  }
+  b->p = p;
+  return 0;
+}
+
+static void iobuf_free(iobuf_t *b) {
+  if (b->map_len > 0) {
+    munmap(b->p, b->map_len);
+  } else {
+    free(b->p);
+  }
+  b->p = NULL;
+  b->len = 0;
+  b->map_len = 0;
+}
+
+static int cook_flush(cook_t *ck) {
+  int rc = write_all(STDOUT_FILENO, ck->out.p, ck->out_len);
+  ck->out_len = 0;
+  return rc;
+}
+
+static int cook_put(cook_t *ck, const void *p, size_t len) {
+  if (ck->out_len + len > ck->out.len) {
+    if (cook_flush(ck) < 0) return -1;
+    if (len >= ck->out.len) return write_all(STDOUT_FILENO, p, len);
+  }
+  memcpy(ck->out.p + ck->out_len, p, len);
+  ck->out_len += len;
+  return 0;
+}
+
+static bool is_special(uint8_t c, const cook_t *ck) {
+  if (c < 0x20) return c != '\t' || ck->show_tabs;
+  return c >= 0x7f;
+}
+
+// Finds the next byte cook_chunk has to rewrite. Plain numbering/squeezing
+// only cares about newlines, which memchr already finds fast; -v needs the
+// whole control/high-bit class, which is checked 16 bytes at a time.
+static const uint8_t *scan_special(const uint8_t *p, const uint8_t *end, const cook_t *ck) {
+  if (!ck->visible) {
+    const uint8_t *nl = memchr(p, '\n', (size_t)(end - p));
+    return nl != NULL ? nl : end;
+  }
+
+#if defined(__SSE2__)
+  const __m128i space = _mm_set1_epi8(0x20);
+  const __m128i del = _mm_set1_epi8(0x7f);
+  const __m128i tab = _mm_set1_epi8('\t');
+  const __m128i plain_tab = ck->show_tabs ? _mm_setzero_si128() : _mm_set1_epi8(-1);
+  while (end - p >= 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    // signed compare: catches C0 controls and every byte >= 0x80 at once
+    __m128i m = _mm_or_si128(_mm_cmplt_epi8(v, space), _mm_cmpeq_epi8(v, del));
+    m = _mm_andnot_si128(_mm_and_si128(_mm_cmpeq_epi8(v, tab), plain_tab), m);
+    int bits = _mm_movemask_epi8(m);
+    if (bits != 0) return p + __builtin_ctz((unsigned)bits);
+    p += 16;
+  }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  while (end - p >= 16) {
+    uint8x16_t v = vld1q_u8(p);
+    uint8x16_t m = vorrq_u8(vcltq_u8(v, vdupq_n_u8(0x20)), vcgeq_u8(v, vdupq_n_u8(0x7f)));
+    if (!ck->show_tabs) m = vbicq_u8(m, vceqq_u8(v, vdupq_n_u8('\t')));
+    if (vmaxvq_u8(m) != 0) break;
+    p += 16;
+  }
+#endif
+  for (; p < end; p++) {
+    if (is_special(*p, ck)) return p;
+  }
+  return end;
+}
+
+// Applies -n/-b/-s/-v/-e/-t to a chunk. State lives in ck so that lines
+// and numbering carry across chunk and file boundaries like BSD cat.
+static int cook_chunk(cook_t *ck, const uint8_t *p, size_t len) {
+  const uint8_t *end = p + len;
+  while (p < end) {
+    if (ck->line_start) {
+      bool blank = *p == '\n';
+      if (ck->squeeze) {
+        if (blank && ck->gobble) {
+          p++;
+          continue;
+        }
+        ck->gobble = blank;
+      }
+      if (ck->number && (!ck->number_nonblank || !blank)) {
+        char num[32];
+        int n = snprintf(num, sizeof(num), "%6zu\t", ++ck->line);
+        if (cook_put(ck, num, (size_t)n) < 0) return -1;
+      } else if (ck->number && ck->show_ends) {
+        if (cook_put(ck, "      \t", 7) < 0) return -1;
+      }
+      ck->line_start = false;
+    }
+
+    const uint8_t *q = scan_special(p, end, ck);
+    if (cook_put(ck, p, (size_t)(q - p)) < 0) return -1;
+    if (q == end) break;
+    p = q + 1;
+
+    uint8_t c = *q;
+    char vis[5];
+    size_t vis_len = 0;
+    if (c == '\n') {
+      if (ck->show_ends) vis[vis_len++] = '$';
+      vis[vis_len++] = '\n';
+      ck->line_start = true;
+    } else {
+      if (c >= 0x80) {
+        vis[vis_len++] = 'M';
+        vis[vis_len++] = '-';
+        c &= 0x7f;
+      }
+      if (c < 0x20 || c == 0x7f) {
+        vis[vis_len++] = '^';
+        vis[vis_len++] = c == 0x7f ? '?' : (char)(c | 0x40);
+      } else {
+        vis[vis_len++] = (char)c;
+      }
+    }
+    if (cook_put(ck, vis, vis_len) < 0) return -1;
+  }
+  return 0;
+}
+
+static int emit(cook_t *ck, int fd, const uint8_t *p, size_t len) {
+  if (ck != NULL) return cook_chunk(ck, p, len);
+  return write_all(fd, p, len);
+}
+
+static int stream_copy(int infd, int outfd, cook_t *ck) {
+  iobuf_t b;
+  if (iobuf_alloc(&b, iobuf_size(infd, outfd)) < 0) return -1;
+
+  int rc = 0;
   for (;;) {
-    ssize_t n = read(infd, buf, sizeof(buf));
+    ssize_t n = read(infd, b.p, b.len);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      rc = -1;
+      break;
+    }
+    if (n == 0) break;
+    if (emit(ck, outfd, b.p, (size_t)n) < 0 || (ck != NULL && cook_flush(ck) < 0)) {
+      rc = -1;
+      break;
+    }
+  }
+
+  int saved = errno;
+  iobuf_free(&b);
+  errno = saved;
+  return rc;
+}
+
+static xfer_e pick_xfer(mode_t out_mode) {
+  if (S_ISREG(out_mode)) return XFER_COPY_FILE_RANGE;
+  if (S_ISFIFO(out_mode)) return XFER_SPLICE;
+  return XFER_SENDFILE;
+}
+
+static bool kernel_refused(int err) {
+  return err == EINVAL || err == ENOSYS || err == EXDEV || err == EOPNOTSUPP || err == EBADF;
+}
+
+// Moves [*off, end) from infd to outfd without passing through user space.
+// *off tracks progress so a refusal part way through can resume elsewhere.
+static kcopy_e kernel_copy(int infd, int outfd, xfer_e how, off_t *off, off_t end) {
+#ifdef __linux__
+  while (*off < end) {
+    size_t chunk = (size_t)(end - *off < XFER_CHUNK ? end - *off : XFER_CHUNK);
+    ssize_t n;
+    switch (how) {
+    case XFER_COPY_FILE_RANGE:
+      n = copy_file_range(infd, off, outfd, NULL, chunk, 0);
+      break;
+    case XFER_SPLICE:
+      n = splice(infd, off, outfd, NULL, chunk, SPLICE_F_MORE);
+      break;
+    default:
+      n = sendfile(outfd, infd, off, chunk);
+      break;
+    }
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return kernel_refused(errno) ? KCOPY_REFUSED : KCOPY_ERROR;
+    }
+    if (n == 0) break;
+  }
+  return KCOPY_DONE;
+#else
+  (void)infd;
+  (void)outfd;
+  (void)how;
+  (void)off;
+  (void)end;
+  errno = ENOSYS;
+  return KCOPY_REFUSED;
+#endif
+}
+
+static int map_window(int fd, off_t off, off_t end, window_t *w) {
+  off_t len = end - off < MAP_WINDOW ? end - off : MAP_WINDOW;
+  void *p = mmap(0, (size_t)len, PROT_READ, MAP_PRIVATE, fd, off);
+  if (p == MAP_FAILED) return -1;
+
+  w->p = p;
+  w->off = off;
+  w->len = (size_t)len;
+  posix_madvise(w->p, w->len, POSIX_MADV_SEQUENTIAL);
+  return 0;
+}
+
+static int unmap_window(window_t *w) {
+  if (w->p == NULL) return 0;
+#ifdef __linux__
+  madvise(w->p, w->len, MADV_DONTNEED);
+#else
+  posix_madvise(w->p, w->len, POSIX_MADV_DONTNEED);
+#endif
+  int rc = munmap(w->p, w->len);
+  w->p = NULL;
+  return rc;
+}
+
+// Writes [off, end) through a pair of sliding MAP_WINDOW mappings: the one
+// being written and the next one, which is prefaulted while we write.
+static int mmap_copy(int fd, int outfd, off_t off, off_t end, cook_t *ck) {
+  if (off >= end) return 0;
+
+  off_t page = (off_t)sysconf(_SC_PAGESIZE);
+  window_t cur = {0};
+  if (map_window(fd, off - off % page, end, &cur) < 0) return -1;
+
+  for (;;) {
+    window_t next = {0};
+    off_t next_off = cur.off + (off_t)cur.len;
+    if (next_off < end) {
+      if (map_window(fd, next_off, end, &next) < 0) {
+        int saved = errno;
+        unmap_window(&cur);
+        errno = saved;
+        return -1;
+      }
+      posix_madvise(next.p, next.len, POSIX_MADV_WILLNEED);
+    }
+
+    if (emit(ck, outfd, cur.p + (off - cur.off), (size_t)(next_off - off)) < 0) {
+      int saved = errno;
+      unmap_window(&cur);
+      unmap_window(&next);
+      errno = saved;
+      return -1;
+    }
+
+    if (unmap_window(&cur) < 0) {
+      int saved = errno;
+      unmap_window(&next);
+      errno = saved;
+      return -1;
+    }
+    if (next.p == NULL) return 0;
+    off = next_off;
+    cur = next;
+  }
+}
+
+static int cat_regular(const char *filename, int fd, off_t off, off_t size, flags_t flags) {
+  if (off >= size) return 0;
+  if (flags.cook != NULL) return mmap_copy(fd, STDOUT_FILENO, off, size, flags.cook);
+
+  xfer_e how = pick_xfer(flags.out_mode);
+  kcopy_e kc = kernel_copy(fd, STDOUT_FILENO, how, &off, size);
+  if (kc == KCOPY_ERROR) return -1;
+  if (kc == KCOPY_DONE) {
+    if (flags.debug) dprintf(STDERR_FILENO, "mcat: %s: %s\n", filename, xfer_names[how]);
+    return 0;
+  }
+
+  if (flags.debug) {
+    dprintf(STDERR_FILENO, "mcat: %s: %s refused (%s) at offset %lld, using %s\n", filename,
+            xfer_names[how], strerror(errno), (long long)off, xfer_names[XFER_MMAP]);
+  }
+  return mmap_copy(fd, STDOUT_FILENO, off, size, NULL);
+}
+
+static int batch_flush(batch_t *b) {
+  if (b == NULL) return 0;
+
+  struct iovec *iov = b->iov;
+  int cnt = b->iovcnt;
+  b->iovcnt = 0;
+  b->used = 0;
+  while (cnt > 0) {
+    ssize_t n = writev(STDOUT_FILENO, iov, cnt);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    if (n == 0) {
+      errno = EIO;
+      return -1;
+    }
+    while (cnt > 0 && (size_t)n >= iov->iov_len) {
+      n -= (ssize_t)iov->iov_len;
+      iov++;
+      cnt--;
+    }
+    if (cnt > 0) {
+      iov->iov_base = (uint8_t *)iov->iov_base + n;
+      iov->iov_len -= (size_t)n;
+    }
+  }
+  return 0;
+}
+
+// Returns room for len more bytes in the arena, flushing first if the arena
+// or the iovec array is full. batch_commit records what was actually filled.
+static uint8_t *batch_reserve(batch_t *b, size_t len) {
+  if (b->iovcnt == BATCH_IOV || b->used + len > b->arena.len) {
+    if (batch_flush(b) < 0) return NULL;
+  }
+  return b->arena.p + b->used;
+}
+
+static void batch_commit(batch_t *b, size_t len) {
+  if (len == 0) return;
+  b->iov[b->iovcnt].iov_base = b->arena.p + b->used;
+  b->iov[b->iovcnt].iov_len = len;
+  b->iovcnt++;
+  b->used += len;
+}
+
+static int batch_read(batch_t *b, int fd, size_t len) {
+  uint8_t *dst = batch_reserve(b, len);
+  if (dst == NULL) return -1;
+
+  size_t have = 0;
+  while (have < len) {
+    ssize_t n = pread(fd, dst + have, len - have, (off_t)have);
     if (n < 0) {
       if (errno == EINTR) continue;
       return -1;
     }
-    if (n == 0) return 0;
-    if (write_all(outfd, buf, (size_t)n) < 0) return -1;
+    if (n == 0) break;
+    have += (size_t)n;
   }
+  batch_commit(b, have);
+  return 0;
 }
 
-static int cat_file(const char *filename) {
+static int cat_fd(const char *filename, int fd, const struct stat *st, off_t off,
+                  flags_t flags) {
+  int rc;
+  if (S_ISREG(st->st_mode)) {
+    rc = cat_regular(filename, fd, off, st->st_size, flags);
+  } else {
+    rc = stream_copy(fd, STDOUT_FILENO, flags.cook);
+  }
+  int copy_errno = 0;
+  if (rc < 0) copy_errno = errno;
+
+  int close_rc = close(fd);
+  int close_errno = 0;
+  if (close_rc < 0) close_errno = errno;
+
+  if (rc < 0) {
+    errno = copy_errno;
+    return -1;
+  }
+
+  if (close_rc < 0) {
+    errno = close_errno;
+    return -1;
+  }
+
+  return 0;
+}
+
+static int cat_file(const char *filename, flags_t flags) {
   if (strcmp(filename, "-") == 0) {
-    return stream_copy(STDIN_FILENO, STDOUT_FILENO);
+    if (batch_flush(flags.batch) < 0) return -1;
+    return stream_copy(STDIN_FILENO, STDOUT_FILENO, flags.cook);
   }
 
   int fd = open(filename, O_RDONLY);
@@ -68,74 +615,392 @@ static int cat_file(const char *filename) {
     return -1;
   }
 
-  if (!S_ISREG(st.st_mode)) {
-    int rc = stream_copy(fd, STDOUT_FILENO);
-    int stream_errno = 0;
-    if (rc < 0) stream_errno = errno;
-    int close_rc = close(fd);
-    int close_errno = 0;
-    if (close_rc < 0) close_errno = errno;
-    if (rc < 0) {
-      errno = stream_errno;
-      return -1;
-    }
-    if (close_rc < 0) {
-      errno = close_errno;
-      return -1;
-    }
-
-    return 0;
+  if (flags.batch != NULL && S_ISREG(st.st_mode) && st.st_size <= SMALL_FILE_MAX) {
+    int rc = batch_read(flags.batch, fd, (size_t)st.st_size);
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return rc;
   }
 
-  size_t sz = st.st_size;
-  if (sz == 0) {
+  if (batch_flush(flags.batch) < 0) {
+    int saved = errno;
     close(fd);
-    return 0;
+    errno = saved;
+    return -1;
+  }
+  return cat_fd(filename, fd, &st, 0, flags);
+}
+
+#ifdef HAVE_IO_URING
+typedef struct {
+  int fd;
+  unsigned entries;
+  unsigned to_submit;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *sq_ring;
+  void *cq_ring;
+  size_t sq_ring_len;
+  size_t cq_ring_len;
+  size_t sqes_len;
+} uring_t;
+
+typedef enum { SLOT_IDLE, SLOT_OPENING, SLOT_READING, SLOT_READY } slot_state_e;
+typedef enum { OP_OPEN, OP_READ } uring_op_e;
+
+typedef struct {
+  slot_state_e state;
+  const char *filename;
+  int fd;
+  int err;
+  struct stat st;
+  uint8_t *buf;
+  size_t len;
+} slot_t;
+
+static void uring_free(uring_t *r) {
+  if (r->sqes != NULL && r->sqes != MAP_FAILED) munmap(r->sqes, r->sqes_len);
+  if (r->cq_ring != NULL && r->cq_ring != MAP_FAILED && r->cq_ring != r->sq_ring) {
+    munmap(r->cq_ring, r->cq_ring_len);
+  }
+  if (r->sq_ring != NULL && r->sq_ring != MAP_FAILED) munmap(r->sq_ring, r->sq_ring_len);
+  close(r->fd);
+}
+
+static int uring_init(uring_t *r, unsigned entries) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  memset(r, 0, sizeof(*r));
+
+  int fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+  if (fd < 0) return -1;
+
+  r->fd = fd;
+  r->entries = params.sq_entries;
+  r->sq_ring_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  r->cq_ring_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single) {
+    if (r->cq_ring_len > r->sq_ring_len) r->sq_ring_len = r->cq_ring_len;
+    r->cq_ring_len = r->sq_ring_len;
   }
+  r->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
 
-  void *p = mmap(0, sz, PROT_READ, MAP_PRIVATE, fd, 0);
-  if (p == MAP_FAILED) {
+  r->sq_ring = mmap(0, r->sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                    IORING_OFF_SQ_RING);
+  if (r->sq_ring != MAP_FAILED) {
+    r->cq_ring = single ? r->sq_ring
+                        : mmap(0, r->cq_ring_len, PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+  }
+  if (r->cq_ring != NULL && r->cq_ring != MAP_FAILED) {
+    r->sqes = mmap(0, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                   IORING_OFF_SQES);
+  }
+  if (r->sqes == NULL || r->sqes == MAP_FAILED) {
     int saved = errno;
-    close(fd);
+    uring_free(r);
     errno = saved;
     return -1;
   }
 
-  int rc = write_all(STDOUT_FILENO, p, sz);
-  int write_errno = 0;
-  if (rc < 0) write_errno = errno;
+  uint8_t *sq = r->sq_ring;
+  uint8_t *cq = r->cq_ring;
+  r->sq_head = (unsigned *)(sq + params.sq_off.head);
+  r->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+  r->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+  r->sq_array = (unsigned *)(sq + params.sq_off.array);
+  r->cq_head = (unsigned *)(cq + params.cq_off.head);
+  r->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+  r->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+  r->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+  return 0;
+}
 
-  int munmap_rc = munmap(p, sz);
-  int munmap_err = 0;
-  if (munmap_rc < 0) munmap_err = errno;
+static int uring_enter(uring_t *r, unsigned wait) {
+  for (;;) {
+    unsigned flags = wait > 0 ? IORING_ENTER_GETEVENTS : 0;
+    long n = syscall(__NR_io_uring_enter, r->fd, r->to_submit, wait, flags, NULL, 0);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    r->to_submit -= (unsigned)n;
+    return 0;
+  }
+}
 
-  int close_rc = close(fd);
-  int close_err = 0;
-  if (close_rc < 0) close_err = errno;
+// Every slot has at most one request in flight and the ring is sized to the
+// slot count, so a free SQE is always available here.
+static struct io_uring_sqe *uring_sqe(uring_t *r, uint64_t user_data) {
+  unsigned tail = *r->sq_tail;
+  unsigned idx = tail & *r->sq_mask;
+  struct io_uring_sqe *sqe = &r->sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->user_data = user_data;
+  r->sq_array[idx] = idx;
+  __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  r->to_submit++;
+  return sqe;
+}
 
-  if (rc < 0) {
-    errno = write_errno;
+static uint64_t slot_tag(size_t slot, uring_op_e op) {
+  return ((uint64_t)slot << 1) | (uint64_t)op;
+}
+
+static void slot_queue(uring_t *r, slot_t *slots, size_t idx, const char *filename) {
+  slot_t *s = &slots[idx];
+  s->filename = filename;
+  s->fd = -1;
+  s->err = 0;
+  s->len = 0;
+  if (strcmp(filename, "-") == 0) {
+    s->state = SLOT_READY;
+    return;
+  }
+
+  struct io_uring_sqe *sqe = uring_sqe(r, slot_tag(idx, OP_OPEN));
+  sqe->opcode = IORING_OP_OPENAT;
+  sqe->fd = AT_FDCWD;
+  sqe->addr = (uint64_t)(uintptr_t)filename;
+  sqe->open_flags = O_RDONLY;
+  s->state = SLOT_OPENING;
+}
+
+static void slot_opened(uring_t *r, slot_t *slots, size_t idx, int res) {
+  slot_t *s = &slots[idx];
+  s->state = SLOT_READY;
+  if (res == -EINVAL || res == -EOPNOTSUPP) {
+    res = open(s->filename, O_RDONLY);
+    if (res < 0) res = -errno;
+  }
+  if (res < 0) {
+    s->err = -res;
+    return;
+  }
+
+  s->fd = res;
+  if (fstat(s->fd, &s->st) < 0) {
+    s->err = errno;
+    return;
+  }
+  if (!S_ISREG(s->st.st_mode) || s->st.st_size == 0) return;
+
+  size_t want = s->st.st_size < PREFETCH_BUF ? (size_t)s->st.st_size : PREFETCH_BUF;
+  struct io_uring_sqe *sqe = uring_sqe(r, slot_tag(idx, OP_READ));
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = s->fd;
+  sqe->addr = (uint64_t)(uintptr_t)s->buf;
+  sqe->len = (unsigned)want;
+  sqe->off = 0;
+  s->state = SLOT_READING;
+}
+
+static void slot_read(slot_t *s, int res) {
+  s->state = SLOT_READY;
+  if (res < 0) {
+    if (res == -EINVAL || res == -EOPNOTSUPP) return;
+    s->err = -res;
+    return;
+  }
+  s->len = (size_t)res;
+}
+
+static int slot_wait(uring_t *r, slot_t *slots, size_t idx) {
+  while (slots[idx].state != SLOT_READY) {
+    if (uring_enter(r, 1) < 0) return -1;
+
+    unsigned head = *r->cq_head;
+    unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+      struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+      size_t slot = (size_t)(cqe->user_data >> 1);
+      if ((cqe->user_data & 1) == OP_OPEN) {
+        slot_opened(r, slots, slot, cqe->res);
+      } else {
+        slot_read(&slots[slot], cqe->res);
+      }
+      head++;
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+  }
+  // reads queued by slot_opened go out now rather than on the next wait
+  if (r->to_submit > 0 && uring_enter(r, 0) < 0) return -1;
+  return 0;
+}
+
+// After a ring failure: reaps every request still in flight and closes
+// the files the slots hold. Returns false if the ring cannot be waited on,
+// in which case the kernel may still write into the slot buffers.
+static bool slot_cancel(uring_t *r, slot_t *slots, size_t nslots) {
+  size_t pending = 0;
+  for (size_t i = 0; i < nslots; i++) {
+    if (slots[i].state == SLOT_OPENING || slots[i].state == SLOT_READING) pending++;
+  }
+  while (pending > 0) {
+    if (uring_enter(r, 1) < 0) return false;
+
+    unsigned head = *r->cq_head;
+    unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+      struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+      slot_t *s = &slots[cqe->user_data >> 1];
+      if ((cqe->user_data & 1) == OP_OPEN && cqe->res >= 0) close(cqe->res);
+      s->state = SLOT_READY;
+      pending--;
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+  }
+  for (size_t i = 0; i < nslots; i++) {
+    if (slots[i].fd >= 0) close(slots[i].fd);
+    slots[i].fd = -1;
+  }
+  return true;
+}
+
+static int cat_slot(slot_t *s, flags_t flags) {
+  if (s->err != 0) {
+    if (s->fd >= 0) close(s->fd);
+    errno = s->err;
     return -1;
   }
 
-  if (munmap_rc < 0) {
-    errno = munmap_err;
+  bool whole = S_ISREG(s->st.st_mode) && (off_t)s->len == s->st.st_size;
+  if (flags.batch != NULL && s->fd >= 0 && whole) {
+    uint8_t *dst = batch_reserve(flags.batch, s->len);
+    if (dst != NULL) {
+      memcpy(dst, s->buf, s->len);
+      batch_commit(flags.batch, s->len);
+    }
+    int saved = errno;
+    close(s->fd);
+    errno = saved;
+    return dst != NULL ? 0 : -1;
+  }
+
+  if (batch_flush(flags.batch) < 0) {
+    int saved = errno;
+    if (s->fd >= 0) close(s->fd);
+    errno = saved;
     return -1;
   }
+  if (s->fd < 0) return stream_copy(STDIN_FILENO, STDOUT_FILENO, flags.cook);
 
-  if (close_rc < 0) {
-    errno = close_err;
+  if (s->len > 0 && emit(flags.cook, STDOUT_FILENO, s->buf, s->len) < 0) {
+    int saved = errno;
+    close(s->fd);
+    errno = saved;
     return -1;
   }
+  return cat_fd(s->filename, s->fd, &s->st, (off_t)s->len, flags);
+}
+
+// Keeps the opens and first reads of the next PREFETCH_DEPTH files in flight
+// while the current file is written. Returns -1 without writing anything if
+// io_uring is unavailable, so the caller can fall back to the plain loop; if
+// the ring fails part way, the remaining files go through cat_file instead.
+static int cat_pipelined(char **files, size_t count, flags_t flags, int *exit_code) {
+  // one slot more than the prefetch depth, so the next file can be queued
+  // before the current one is written out of its slot
+  size_t nslots = count < PREFETCH_DEPTH + 1 ? count : PREFETCH_DEPTH + 1;
+  uring_t r;
+  if (uring_init(&r, (unsigned)nslots) < 0) return -1;
+
+  slot_t slots[PREFETCH_DEPTH + 1];
+  memset(slots, 0, sizeof(slots));
+  uint8_t *bufs = malloc(nslots * PREFETCH_BUF);
+  if (bufs == NULL) {
+    uring_free(&r);
+    return -1;
+  }
+  for (size_t i = 0; i < nslots; i++) {
+    slots[i].buf = bufs + i * PREFETCH_BUF;
+    slots[i].fd = -1;
+    if (i + 1 < nslots) slot_queue(&r, slots, i, files[i]);
+  }
+
+  size_t i = 0;
+  for (; i < count; i++) {
+    size_t ahead = i + nslots - 1;
+    if (ahead < count) slot_queue(&r, slots, ahead % nslots, files[ahead]);
+    size_t idx = i % nslots;
+    if (uring_enter(&r, 0) < 0 || slot_wait(&r, slots, idx) < 0) break;
+
+    if (flags.debug && slots[idx].err == 0) {
+      dprintf(STDERR_FILENO, "mcat: %s: prefetched %zu bytes via io_uring\n", files[i],
+              slots[idx].len);
+    }
+    if (cat_slot(&slots[idx], flags) < 0) {
+      error_msg(files[i]);
+      *exit_code = 1;
+    }
+    slots[idx].state = SLOT_IDLE;
+    slots[idx].fd = -1;
+  }
+
+  bool drained = true;
+  if (i < count) {
+    if (flags.debug) {
+      dprintf(STDERR_FILENO, "mcat: io_uring: %s, continuing without it\n", strerror(errno));
+    }
+    drained = slot_cancel(&r, slots, nslots);
+  }
+  uring_free(&r);
+  // reads still in flight may land in bufs, so those are left allocated
+  if (drained) free(bufs);
 
+  for (; i < count; i++) {
+    if (cat_file(files[i], flags) < 0) {
+      error_msg(files[i]);
+      *exit_code = 1;
+    }
+  }
   return 0;
 }
+#endif
 
 int main(int argc, char *argv[]) {
   int ch;
+  flags_t flags = {0};
+  cook_t cook = {.line_start = true};
 
-  while ((ch = getopt(argc, argv, "")) != -1) {
+  while ((ch = getopt(argc, argv, "Dbenstv")) != -1) {
     switch (ch) {
+    case 'D':
+      flags.debug = true;
+      break;
+    case 'b':
+      cook.number = cook.number_nonblank = true;
+      flags.cook = &cook;
+      break;
+    case 'e':
+      cook.show_ends = cook.visible = true;
+      flags.cook = &cook;
+      break;
+    case 'n':
+      cook.number = true;
+      flags.cook = &cook;
+      break;
+    case 's':
+      cook.squeeze = true;
+      flags.cook = &cook;
+      break;
+    case 't':
+      cook.show_tabs = cook.visible = true;
+      flags.cook = &cook;
+      break;
+    case 'v':
+      cook.visible = true;
+      flags.cook = &cook;
+      break;
     case '?':
     default:
       usage();
@@ -143,21 +1008,57 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  if (flags.cook != NULL &&
+      iobuf_alloc(&cook.out, iobuf_size(STDIN_FILENO, STDOUT_FILENO)) < 0) {
+    error_msg("malloc");
+    return 1;
+  }
+
   if (optind == argc) {
-    if (stream_copy(STDIN_FILENO, STDOUT_FILENO) < 0) {
+    if (stream_copy(STDIN_FILENO, STDOUT_FILENO, flags.cook) < 0) {
       error_msg("stdin");
       return 1;
     }
     return 0;
   }
 
+  struct stat out_st;
+  if (fstat(STDOUT_FILENO, &out_st) == 0) flags.out_mode = out_st.st_mode;
+
+  batch_t *batch = NULL;
+  if (flags.cook == NULL && argc - optind > 1) {
+    batch = malloc(sizeof(*batch));
+    if (batch != NULL && iobuf_alloc(&batch->arena, BATCH_ARENA) == 0) {
+      batch->used = 0;
+      batch->iovcnt = 0;
+      flags.batch = batch;
+    } else {
+      free(batch);
+      batch = NULL;
+    }
+  }
+
   int exit_code = 0;
-  for (int i = optind; i < argc; i++) {
+  bool done = false;
+#ifdef HAVE_IO_URING
+  done = argc - optind > 1 &&
+         cat_pipelined(argv + optind, (size_t)(argc - optind), flags, &exit_code) == 0;
+#endif
+  for (int i = optind; !done && i < argc; i++) {
     char *filename = argv[i];
-    if (cat_file(filename) < 0) {
+    if (cat_file(filename, flags) < 0) {
       error_msg(filename);
       exit_code = 1;
     }
   }
+
+  if (batch_flush(flags.batch) < 0) {
+    error_msg("stdout");
+    exit_code = 1;
+  }
+  if (flags.cook != NULL && cook_flush(flags.cook) < 0) {
+    error_msg("stdout");
+    exit_code = 1;
+  }
   return exit_code;
 }
@@ -1,8 +1,13 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
 #define _POSIX_C_SOURCE 200809L
 
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,20 +15,62 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_AVX2_KERNEL 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+#define IOBUF_DEFAULT (64 * 1024)
+#define IOBUF_AUTO_MAX (1024 * 1024)
+#define IOBUF_HUGE (2 * 1024 * 1024)
+#define IOBUF_MAX (256 * 1024 * 1024)
+#define HEAD_WORKERS 8
+#define HEAD_JOB_CAP (4 * 1024 * 1024)
 
 typedef enum { COUNT_OK, COUNT_INVALID, COUNT_RANGE } count_e;
 typedef enum { MODE_LINES, MODE_BYTES, MODE_DEFAULT } mode_e;
 
 typedef struct {
   mode_e mode;
+  bool all_but;
   union {
     size_t lines;
     size_t bytes;
   } as;
 } count_t;
 
+typedef struct {
+  const char *filename;
+  int fd;
+  int err;
+  bool done;
+  bool regular;
+  char *data;
+  size_t sz;
+  size_t want;
+  size_t scanned;
+  size_t found;
+} job_t;
+
+typedef struct {
+  job_t *jobs;
+  size_t count;
+  size_t next;
+  size_t emitted;
+  size_t window;
+  count_t c;
+  pthread_mutex_t lock;
+  pthread_cond_t taken;
+  pthread_cond_t finished;
+} pool_t;
+
 static void usage(void) {
-  dprintf(STDERR_FILENO, "Usage: head [-n lines | -c bytes] [file ...]\n");
+  dprintf(STDERR_FILENO, "Usage: head [-n [-]lines | -c [-]bytes] [file ...]\n");
 }
 
 static void error_errno(const char *progname, const char *filename) {
@@ -34,15 +81,16 @@ static void error_msg(const char *progname, const char *msg) {
   dprintf(STDERR_FILENO, "%s: %s\n", progname, msg);
 }
 
-static count_e parse_count(const char *s, size_t *out) {
+static count_e parse_count(const char *s, size_t *out, bool *all_but) {
   errno = 0;
   char *end = NULL;
   long val = strtol(s, &end, 10);
   if (end == s || *end != '\0') return COUNT_INVALID;
-  if (errno == ERANGE || val > INT_MAX) return COUNT_RANGE;
-  if (val <= 0) return COUNT_INVALID;
+  if (errno == ERANGE || val > INT_MAX || val < -INT_MAX) return COUNT_RANGE;
+  if (val == 0) return COUNT_INVALID;
 
-  *out = (int)val;
+  *all_but = val < 0;
+  *out = (size_t)(val < 0 ? -val : val);
   return COUNT_OK;
 }
 
@@ -64,42 +112,289 @@ static int write_all(int fd, const void *buf, size_t len) {
   return 0;
 }
 
-static int stream_copy(int infd, int outfd, count_t count) {
-  uint8_t buf[1024 * 64] = {0};
+typedef size_t (*nl_kernel_fn)(const uint8_t *p, size_t len, size_t n, size_t *found);
+
+static size_t nth_newline_scalar(const uint8_t *p, size_t len, size_t n, size_t *found) {
+  size_t off = 0;
+  while (*found < n) {
+    const uint8_t *nl = memchr(p + off, '\n', len - off);
+    if (nl == NULL) return len;
+    off = (size_t)(nl - p) + 1;
+    (*found)++;
+  }
+  return off;
+}
+
+// bits has one set bit per newline in a block starting at off. Either the
+// nth newline is in this block and its end offset is returned, or the
+// block's newlines are added to *found and 0 is returned.
+static size_t take_block(uint64_t bits, unsigned per_byte, size_t off, size_t n, size_t *found) {
+  size_t cnt = (size_t)__builtin_popcountll(bits) / per_byte;
+  if (*found + cnt < n) {
+    *found += cnt;
+    return 0;
+  }
+  uint64_t lane = ((uint64_t)1 << per_byte) - 1;
+  for (size_t skip = n - *found - 1; skip > 0; skip--) {
+    bits &= ~(lane << __builtin_ctzll(bits));
+  }
+  *found = n;
+  return off + (size_t)__builtin_ctzll(bits) / per_byte + 1;
+}
+
+#if defined(__SSE2__)
+static size_t nth_newline_sse2(const uint8_t *p, size_t len, size_t n, size_t *found) {
+  const __m128i nl = _mm_set1_epi8('\n');
+  size_t off = 0;
+  for (; off + 16 <= len && *found < n; off += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + off));
+    uint64_t bits = (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+    if (bits == 0) continue;
+    size_t end = take_block(bits, 1, off, n, found);
+    if (end != 0) return end;
+  }
+  if (*found >= n) return off;
+  size_t tail = nth_newline_scalar(p + off, len - off, n, found);
+  return off + tail;
+}
+#endif
+
+#ifdef HAVE_AVX2_KERNEL
+__attribute__((target("avx2"))) static size_t nth_newline_avx2(const uint8_t *p, size_t len,
+                                                               size_t n, size_t *found) {
+  const __m256i nl = _mm256_set1_epi8('\n');
+  size_t off = 0;
+  for (; off + 64 <= len && *found < n; off += 64) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(p + off));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(p + off + 32));
+    uint64_t lo = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, nl));
+    uint64_t hi = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(b, nl));
+    uint64_t bits = lo | (hi << 32);
+    if (bits == 0) continue;
+    size_t end = take_block(bits, 1, off, n, found);
+    if (end != 0) return end;
+  }
+  if (*found >= n) return off;
+  size_t tail = nth_newline_scalar(p + off, len - off, n, found);
+  return off + tail;
+}
+#endif
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+static size_t nth_newline_neon(const uint8_t *p, size_t len, size_t n, size_t *found) {
+  const uint8x16_t nl = vdupq_n_u8('\n');
+  size_t off = 0;
+  for (; off + 16 <= len && *found < n; off += 16) {
+    uint8x16_t eq = vceqq_u8(vld1q_u8(p + off), nl);
+    // narrow to 4 bits per byte so the block fits a 64-bit mask
+    uint8x8_t narrowed = vshrn_n_u16(vreinterpretq_u16_u8(eq), 4);
+    uint64_t bits = vget_lane_u64(vreinterpret_u64_u8(narrowed), 0);
+    if (bits == 0) continue;
+    size_t end = take_block(bits, 4, off, n, found);
+    if (end != 0) return end;
+  }
+  if (*found >= n) return off;
+  size_t tail = nth_newline_scalar(p + off, len - off, n, found);
+  return off + tail;
+}
+#endif
+
+static nl_kernel_fn nl_kernel = NULL;
+
+// Called from main before any worker starts, so the pointer is never
+// raced on.
+static void nl_kernel_init(void) {
+  nl_kernel = nth_newline_scalar;
+#if defined(__SSE2__)
+  nl_kernel = nth_newline_sse2;
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  nl_kernel = nth_newline_neon;
+#endif
+#ifdef HAVE_AVX2_KERNEL
+  if (__builtin_cpu_supports("avx2")) nl_kernel = nth_newline_avx2;
+#endif
+}
+
+// Returns the offset just past the nth newline in [p, p + len), or len when
+// there are fewer. *found is advanced by the newlines consumed, so callers
+// can carry a running count across buffers.
+static size_t nth_newline(const uint8_t *p, size_t len, size_t n, size_t *found) {
+  if (nl_kernel == NULL) nl_kernel_init();
+  if (*found >= n) return 0;
+  return nl_kernel(p, len, n, found);
+}
+
+static const uint8_t *last_newline(const uint8_t *p, size_t len) {
+#ifdef __GLIBC__
+  return memrchr(p, '\n', len);
+#else
+  while (len > 0) {
+    if (p[--len] == '\n') return p + len;
+  }
+  return NULL;
+#endif
+}
+
+// Offset where the last n lines of [p, p + len) begin, scanning backward
+// from the end the way tail does. An unterminated last line counts.
+static size_t last_lines_start(const uint8_t *p, size_t len, size_t n) {
+  size_t end = len;
+  if (end > 0 && p[end - 1] == '\n') end--;
+  for (size_t i = 0; i < n; i++) {
+    const uint8_t *nl = last_newline(p, end);
+    if (nl == NULL) return 0;
+    end = (size_t)(nl - p);
+  }
+  return end + 1;
+}
+
+// Streams all but the last k bytes. At most k bytes are ever held back, in
+// a ring; anything older is written as soon as it is pushed out.
+static int stream_all_but_bytes(int infd, int outfd, size_t k, uint8_t *buf, size_t buf_len) {
+  uint8_t *ring = malloc(k);
+  if (ring == NULL) return -1;
+  size_t start = 0;
+  size_t held = 0;
+
+  int rc = 0;
+  for (;;) {
+    ssize_t r = read(infd, buf, buf_len);
+    if (r < 0) {
+      if (errno == EINTR) continue;
+      rc = -1;
+      break;
+    }
+    if (r == 0) break;
+
+    size_t n = (size_t)r;
+    size_t excess = held + n > k ? held + n - k : 0;
+    size_t from_ring = excess < held ? excess : held;
+    while (from_ring > 0) {
+      size_t chunk = k - start < from_ring ? k - start : from_ring;
+      if (write_all(outfd, ring + start, chunk) < 0) {
+        rc = -1;
+        break;
+      }
+      start = (start + chunk) % k;
+      held -= chunk;
+      from_ring -= chunk;
+      excess -= chunk;
+    }
+    if (rc < 0) break;
+    if (excess > 0 && write_all(outfd, buf, excess) < 0) {
+      rc = -1;
+      break;
+    }
+
+    for (size_t i = excess; i < n;) {
+      size_t pos = (start + held) % k;
+      size_t chunk = k - pos < n - i ? k - pos : n - i;
+      memcpy(ring + pos, buf + i, chunk);
+      held += chunk;
+      i += chunk;
+    }
+  }
+
+  int saved = errno;
+  free(ring);
+  errno = saved;
+  return rc;
+}
+
+// Streams all but the last k lines. Pending input is kept in one growable
+// buffer holding at most k lines plus the read in progress; whenever it
+// holds more, the oldest surplus lines are written in one go. The buffer is
+// only compacted once more of it has been written than is still held, so
+// every byte is moved at most a constant number of times on average.
+static int stream_all_but_lines(int infd, int outfd, size_t k, size_t buf_len) {
+  uint8_t *hold = NULL;
+  size_t cap = 0;
+  size_t start = 0;
+  size_t end = 0;
+  size_t lines = 0;
+
+  int rc = 0;
+  for (;;) {
+    if (cap - end < buf_len) {
+      if (start > 0 && start >= end - start) {
+        memmove(hold, hold + start, end - start);
+        end -= start;
+        start = 0;
+      }
+      if (cap - end < buf_len) {
+        size_t new_cap = cap == 0 ? buf_len * 2 : cap * 2;
+        uint8_t *grown = realloc(hold, new_cap);
+        if (grown == NULL) {
+          rc = -1;
+          break;
+        }
+        hold = grown;
+        cap = new_cap;
+      }
+    }
+
+    ssize_t r = read(infd, hold + end, buf_len);
+    if (r < 0) {
+      if (errno == EINTR) continue;
+      rc = -1;
+      break;
+    }
+
+    if (r > 0) {
+      nth_newline(hold + end, (size_t)r, SIZE_MAX, &lines);
+      end += (size_t)r;
+    }
+
+    size_t total = lines;
+    if (end > start && hold[end - 1] != '\n') total++;
+    if (total > k) {
+      size_t found = 0;
+      size_t cut = nth_newline(hold + start, end - start, total - k, &found);
+      if (write_all(outfd, hold + start, cut) < 0) {
+        rc = -1;
+        break;
+      }
+      start += cut;
+      lines -= found;
+    }
+    if (r == 0) break;
+  }
+
+  int saved = errno;
+  free(hold);
+  errno = saved;
+  return rc;
+}
+
+static int stream_copy_buf(int infd, int outfd, count_t count, uint8_t *buf, size_t buf_len) {
+  if (count.all_but) {
+    if (count.mode == MODE_BYTES) {
+      return stream_all_but_bytes(infd, outfd, count.as.bytes, buf, buf_len);
+    }
+    return stream_all_but_lines(infd, outfd, count.as.lines, buf_len);
+  }
+
   switch (count.mode) {
   case MODE_DEFAULT:
   case MODE_LINES: {
     size_t lines_so_far = 0;
-    for (;;) {
-      if (lines_so_far >= count.as.lines) break;
-      ssize_t n = read(infd, buf, sizeof(buf));
+    while (lines_so_far < count.as.lines) {
+      ssize_t n = read(infd, buf, buf_len);
       if (n < 0) {
         if (errno == EINTR) continue;
         return -1;
       }
       if (n == 0) break;
 
-      char *buf_p = (char *)buf;
-      char *p = NULL;
-      size_t remaining = n;
-      while ((p = memchr(buf_p, '\n', remaining)) != NULL) {
-        if (lines_so_far >= count.as.lines) break;
-        size_t pos = (size_t)(p - buf_p) + 1;
-        if (write_all(outfd, buf_p, pos) < 0) return -1;
-        lines_so_far++;
-        buf_p += pos;
-        remaining -= pos;
-      }
-      if (lines_so_far < count.as.lines && remaining > 0) {
-        if (write_all(outfd, buf_p, remaining) < 0) return -1;
-      }
+      size_t end = nth_newline(buf, (size_t)n, count.as.lines, &lines_so_far);
+      if (write_all(outfd, buf, end) < 0) return -1;
     }
     break;
   }
   case MODE_BYTES: {
     size_t need = count.as.bytes;
     if (need == 0) break;
-    if (isatty(infd) != 0 && need <= sizeof(buf)) {
+    if (isatty(infd) != 0 && need <= buf_len) {
       size_t have = 0;
       while (have < need) {
         ssize_t n = read(infd, buf + have, need - have);
@@ -121,7 +416,7 @@ static int stream_copy(int infd, int outfd, count_t count) {
     size_t left = count.as.bytes;
     if (left == 0) break;
     while (left > 0) {
-      ssize_t n = read(infd, buf, sizeof(buf));
+      ssize_t n = read(infd, buf, buf_len);
       if (n < 0) {
         if (errno == EINTR) continue;
         return -1;
@@ -138,101 +433,338 @@ static int stream_copy(int infd, int outfd, count_t count) {
   return 0;
 }
 
-static int head_file(const char *filename, count_t c) {
-  int fd = open(filename, O_RDONLY);
-  if (fd < 0) {
-    return -1;
+typedef struct {
+  uint8_t *p;
+  size_t len;
+  size_t map_len;
+} iobuf_t;
+
+static size_t iobuf_env_size(void) {
+  const char *s = getenv("CORE_UTILS_BUFSIZE");
+  // strtoull would take "-1" and wrap it; only plain digits are a size
+  if (s == NULL || *s < '0' || *s > '9') return 0;
+
+  // out-of-range values saturate at ULLONG_MAX and are clamped below
+  char *end = NULL;
+  unsigned long long val = strtoull(s, &end, 10);
+  if (end == s) return 0;
+  unsigned shift = 0;
+  if (*end == 'k' || *end == 'K') {
+    shift = 10;
+    end++;
+  } else if (*end == 'm' || *end == 'M') {
+    shift = 20;
+    end++;
   }
+  if (*end != '\0') return 0;
+  if (val > ((unsigned long long)IOBUF_MAX >> shift)) return IOBUF_MAX;
+  return (size_t)val << shift;
+}
 
-  struct stat st;
-  if (fstat(fd, &st) < 0) {
-    int saved = errno;
-    close(fd);
-    errno = saved;
-    return -1;
+// Honors CORE_UTILS_BUFSIZE, falling back to st_blksize / F_GETPIPE_SZ of
+// the two ends. Only an explicit size is allowed to resize the pipes.
+static size_t iobuf_size(int infd, int outfd) {
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t want = iobuf_env_size();
+  bool explicit_size = want != 0;
+  int fds[2] = {infd, outfd};
+
+  if (!explicit_size) {
+    want = IOBUF_DEFAULT;
+    for (size_t i = 0; i < 2; i++) {
+      struct stat st;
+      if (fstat(fds[i], &st) < 0) continue;
+      if (st.st_blksize > 0 && (size_t)st.st_blksize > want) want = (size_t)st.st_blksize;
+#ifdef F_GETPIPE_SZ
+      if (S_ISFIFO(st.st_mode)) {
+        int cap = fcntl(fds[i], F_GETPIPE_SZ);
+        if (cap > 0 && (size_t)cap > want) want = (size_t)cap;
+      }
+#endif
+    }
+    if (want > IOBUF_AUTO_MAX) want = IOBUF_AUTO_MAX;
   }
 
-  if (!S_ISREG(st.st_mode)) {
-    int rc = stream_copy(fd, STDOUT_FILENO, c);
-    int stream_errno = 0;
-    if (rc < 0) stream_errno = errno;
-    int close_rc = close(fd);
-    int close_errno = 0;
-    if (close_rc < 0) close_errno = errno;
-    if (rc < 0) {
-      errno = stream_errno;
-      return -1;
+  if (want < page) want = page;
+  want = (want + page - 1) / page * page;
+
+#ifdef F_SETPIPE_SZ
+  if (explicit_size) {
+    for (size_t i = 0; i < 2; i++) {
+      struct stat st;
+      if (fstat(fds[i], &st) < 0 || !S_ISFIFO(st.st_mode)) continue;
+      int cap = fcntl(fds[i], F_GETPIPE_SZ);
+      if (cap > 0 && (size_t)cap < want) fcntl(fds[i], F_SETPIPE_SZ, (int)want);
+    }
+  }
+#endif
+  return want;
+}
+
+static int iobuf_alloc(iobuf_t *b, size_t len) {
+  b->len = len;
+  b->map_len = 0;
+#ifdef MAP_ANONYMOUS
+  if (len >= IOBUF_HUGE) {
+    size_t map_len = (len + IOBUF_HUGE - 1) / IOBUF_HUGE * IOBUF_HUGE;
+    uint8_t *raw = mmap(NULL, map_len + IOBUF_HUGE, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw != MAP_FAILED) {
+      size_t lead = (IOBUF_HUGE - (uintptr_t)raw % IOBUF_HUGE) % IOBUF_HUGE;
+      if (lead > 0) munmap(raw, lead);
+      munmap(raw + lead + map_len, IOBUF_HUGE - lead);
+      b->p = raw + lead;
+      b->map_len = map_len;
+#ifdef MADV_HUGEPAGE
+      madvise(b->p, b->map_len, MADV_HUGEPAGE);
+#endif
+      return 0;
     }
-    if (close_rc < 0) {
-      errno = close_errno;
+  }
+#endif
+  void *p = NULL;
+  int rc = posix_memalign(&p, (size_t)sysconf(_SC_PAGESIZE), len);
+  if (rc != 0) {
+    errno = rc;
+    return -1;
+  }
+  b->p = p;
+  return 0;
+}
+
+static void iobuf_free(iobuf_t *b) {
+  if (b->map_len > 0) {
+    munmap(b->p, b->map_len);
+  } else {
+    free(b->p);
+  }
+  b->p = NULL;
+  b->len = 0;
+  b->map_len = 0;
+}
+
+static int stream_copy(int infd, int outfd, count_t count) {
+  iobuf_t b;
+  if (iobuf_alloc(&b, iobuf_size(infd, outfd)) < 0) return -1;
+  int rc = stream_copy_buf(infd, outfd, count, b.p, b.len);
+  int saved = errno;
+  iobuf_free(&b);
+  errno = saved;
+  return rc;
+}
+
+// Sends the first len bytes of fd to stdout, zero-copy where the kernel
+// allows it and from the mapping otherwise.
+static int emit_prefix(int fd, const char *data, size_t len) {
+  size_t off = 0;
+#ifdef __linux__
+  off_t pos = 0;
+  while ((size_t)pos < len) {
+    ssize_t n = sendfile(STDOUT_FILENO, fd, &pos, len - (size_t)pos);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP) break;
       return -1;
     }
-    return 0;
+    if (n == 0) break;
   }
+  off = (size_t)pos;
+#else
+  (void)fd;
+#endif
+  if (off >= len) return 0;
+  return write_all(STDOUT_FILENO, data + off, len - off);
+}
 
-  size_t sz = st.st_size;
-  if (sz == 0) {
-    close(fd);
-    return 0;
+// Opens and maps a file and works out how much of it to print, touching at
+// most cap bytes. Anything left unresolved is finished by head_emit. Errors
+// are kept in job->err so they are reported in argument order.
+static void head_prepare(job_t *job, count_t c, size_t cap) {
+  job->fd = open(job->filename, O_RDONLY);
+  if (job->fd < 0) {
+    job->err = errno;
+    return;
   }
 
-  char *data = (char *)mmap(NULL, sz, PROT_READ, MAP_PRIVATE, fd, 0);
-  if (data == MAP_FAILED) {
-    int saved = errno;
-    close(fd);
-    errno = saved;
-    return -1;
+  struct stat st;
+  if (fstat(job->fd, &st) < 0) {
+    job->err = errno;
+    return;
+  }
+  if (!S_ISREG(st.st_mode)) return;
+
+  job->regular = true;
+  job->sz = st.st_size;
+  if (job->sz == 0) return;
+
+  job->data = (char *)mmap(NULL, job->sz, PROT_READ, MAP_PRIVATE, job->fd, 0);
+  if (job->data == MAP_FAILED) {
+    job->data = NULL;
+    job->err = errno;
+    return;
   }
 
+  const uint8_t *data = (const uint8_t *)job->data;
   switch (c.mode) {
   case MODE_DEFAULT:
   case MODE_LINES: {
-    size_t lines_so_far = 0;
-    char *data_p = data;
-    char *p = NULL;
-    size_t remaining = sz;
-    while ((p = memchr(data_p, '\n', remaining)) != NULL) {
-      if (lines_so_far >= c.as.lines) break;
-      size_t line_pos = (size_t)(p - data_p) + 1;
-      if (write_all(STDOUT_FILENO, data_p, line_pos) < 0) {
-        int saved = errno;
-        munmap(data, sz);
-        close(fd);
-        errno = saved;
-        return -1;
-      }
-      lines_so_far++;
-      data_p += line_pos;
-      remaining -= line_pos;
-    }
-    if (lines_so_far < c.as.lines && remaining > 0) {
-      if (write_all(STDOUT_FILENO, data_p, remaining) < 0) {
-        int saved = errno;
-        munmap(data, sz);
-        close(fd);
-        errno = saved;
-        return -1;
-      }
+    if (c.all_but) {
+      job->want = last_lines_start(data, job->sz, c.as.lines);
+      job->scanned = job->sz;
+      break;
     }
-    munmap(data, sz);
-    close(fd);
+    size_t limit = job->sz < cap ? job->sz : cap;
+    job->want = nth_newline(data, limit, c.as.lines, &job->found);
+    job->scanned = job->found == c.as.lines ? job->sz : limit;
     break;
   }
-  case MODE_BYTES: {
-    size_t to_write = c.as.bytes < sz ? c.as.bytes : sz;
-    if (write_all(STDOUT_FILENO, data, to_write) < 0) {
-      int saved = errno;
-      munmap(data, sz);
-      close(fd);
-      errno = saved;
-      return -1;
+  case MODE_BYTES:
+    if (c.all_but) {
+      job->want = job->sz > c.as.bytes ? job->sz - c.as.bytes : 0;
+    } else {
+      job->want = c.as.bytes < job->sz ? c.as.bytes : job->sz;
+    }
+    job->scanned = job->sz;
+    if (job->want > 0) {
+      posix_madvise(job->data, job->want < cap ? job->want : cap, POSIX_MADV_WILLNEED);
     }
-    munmap(data, sz);
-    close(fd);
     break;
   }
+}
+
+static int head_emit(job_t *job, count_t c) {
+  int rc = 0;
+  if (!job->regular) {
+    rc = stream_copy(job->fd, STDOUT_FILENO, c);
+  } else if (job->data != NULL) {
+    if (job->scanned < job->sz) {
+      job->want = job->scanned + nth_newline((const uint8_t *)job->data + job->scanned,
+                                             job->sz - job->scanned, c.as.lines, &job->found);
+    }
+    rc = emit_prefix(job->fd, job->data, job->want);
   }
-  return 0;
+  return rc;
+}
+
+static int head_release(job_t *job) {
+  if (job->data != NULL) munmap(job->data, job->sz);
+  job->data = NULL;
+  if (job->fd < 0) return 0;
+  int rc = close(job->fd);
+  job->fd = -1;
+  return rc;
+}
+
+static int head_file(const char *filename, count_t c) {
+  job_t job = {.filename = filename, .fd = -1};
+  head_prepare(&job, c, SIZE_MAX);
+  int rc = 0;
+  if (job.err != 0) {
+    errno = job.err;
+    rc = -1;
+  } else {
+    rc = head_emit(&job, c);
+  }
+
+  int saved = errno;
+  int close_rc = head_release(&job);
+  if (rc < 0) {
+    errno = saved;
+    return -1;
+  }
+  return close_rc;
+}
+
+static void *head_worker(void *arg) {
+  pool_t *pool = arg;
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (pool->next < pool->count && pool->next >= pool->emitted + pool->window) {
+      pthread_cond_wait(&pool->taken, &pool->lock);
+    }
+    if (pool->next >= pool->count) break;
+
+    job_t *job = &pool->jobs[pool->next++];
+    pthread_mutex_unlock(&pool->lock);
+    head_prepare(job, pool->c, HEAD_JOB_CAP);
+    pthread_mutex_lock(&pool->lock);
+    job->done = true;
+    pthread_cond_broadcast(&pool->finished);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+// Opens and prefaults up to window files ahead on a pool of workers while
+// the main thread prints them, with headers, strictly in argument order.
+// Each in-flight file touches at most HEAD_JOB_CAP bytes before its turn.
+static int head_files(const char *progname, char **files, size_t count, count_t c) {
+  job_t *jobs = calloc(count, sizeof(*jobs));
+  if (jobs == NULL) {
+    error_errno(progname, "calloc");
+    return 1;
+  }
+  for (size_t i = 0; i < count; i++) {
+    jobs[i].filename = files[i];
+    jobs[i].fd = -1;
+  }
+
+  size_t nworkers = count < HEAD_WORKERS ? count : HEAD_WORKERS;
+  pool_t pool = {.jobs = jobs, .count = count, .window = nworkers * 2, .c = c};
+  pthread_mutex_init(&pool.lock, NULL);
+  pthread_cond_init(&pool.taken, NULL);
+  pthread_cond_init(&pool.finished, NULL);
+
+  pthread_t workers[HEAD_WORKERS];
+  size_t started = 0;
+  for (; started < nworkers; started++) {
+    if (pthread_create(&workers[started], NULL, head_worker, &pool) != 0) break;
+  }
+
+  int exit_code = 0;
+  bool first = true;
+  for (size_t i = 0; i < count; i++) {
+    job_t *job = &jobs[i];
+    if (started == 0) {
+      head_prepare(job, c, SIZE_MAX);
+    } else {
+      pthread_mutex_lock(&pool.lock);
+      while (!job->done) pthread_cond_wait(&pool.finished, &pool.lock);
+      pthread_mutex_unlock(&pool.lock);
+    }
+
+    int rc = 0;
+    if (job->err != 0) {
+      errno = job->err;
+      rc = -1;
+    } else {
+      dprintf(STDOUT_FILENO, "%s==> %s <==\n", first ? "" : "\n", job->filename);
+      first = false;
+      rc = head_emit(job, c);
+    }
+    int saved = errno;
+    if (head_release(job) < 0 && rc == 0) {
+      saved = errno;
+      rc = -1;
+    }
+    if (rc < 0) {
+      errno = saved;
+      error_errno(progname, job->filename);
+      exit_code = 1;
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    pool.emitted = i + 1;
+    pthread_cond_broadcast(&pool.taken);
+    pthread_mutex_unlock(&pool.lock);
+  }
+
+  for (size_t i = 0; i < started; i++) pthread_join(workers[i], NULL);
+  pthread_cond_destroy(&pool.finished);
+  pthread_cond_destroy(&pool.taken);
+  pthread_mutex_destroy(&pool.lock);
+  free(jobs);
+  return exit_code;
 }
 
 int main(int argc, char *argv[]) {
@@ -240,11 +772,13 @@ int main(int argc, char *argv[]) {
 
   size_t lc = 0;
   size_t cc = 0;
+  bool lc_all_but = false;
+  bool cc_all_but = false;
 
   while ((ch = getopt(argc, argv, "n:c:")) != -1) {
     switch (ch) {
     case 'n': {
-      count_e res = parse_count(optarg, &lc);
+      count_e res = parse_count(optarg, &lc, &lc_all_but);
       if (res != COUNT_OK) {
         dprintf(STDERR_FILENO, "%s: illegal line count -- %s\n", argv[0], optarg);
         return 1;
@@ -252,7 +786,7 @@ int main(int argc, char *argv[]) {
       break;
     }
     case 'c': {
-      count_e res = parse_count(optarg, &cc);
+      count_e res = parse_count(optarg, &cc, &cc_all_but);
       if (res != COUNT_OK) {
         dprintf(STDERR_FILENO, "%s: illegal byte count -- %s\n", argv[0], optarg);
         return 1;
@@ -271,9 +805,11 @@ int main(int argc, char *argv[]) {
     return 1;
   } else if (lc > 0) {
     c.mode = MODE_LINES;
+    c.all_but = lc_all_but;
     c.as.lines = lc;
   } else if (cc > 0) {
     c.mode = MODE_BYTES;
+    c.all_but = cc_all_but;
     c.as.bytes = cc;
   } else {
     c.mode = MODE_DEFAULT;
@@ -288,6 +824,9 @@ int main(int argc, char *argv[]) {
     return 0;
   }
 
+  nl_kernel_init();
+  if (argc - optind > 1) return head_files(argv[0], argv + optind, (size_t)(argc - optind), c);
+
   int exit_code = 0;
   for (int i = optind; i < argc; i++) {
     char *filename = argv[i];
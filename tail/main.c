@@ -1,15 +1,53 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <limits.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <sys/sendfile.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_AVX2_KERNEL 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
 #define BLOCK_SIZE 512 // 512 bytes
+#define SCAN_BLOCK (256 * 1024)
+#define REVERSE_WINDOW (8 * 1024 * 1024)
+#define FILTER_WINDOW (8 * 1024 * 1024)
+#define LINE_ARENA_MIN (64 * 1024)
+#define LINE_ARENA_MAX ((size_t)1 << 30)
+#ifdef IOV_MAX
+#define WRITEV_MAX IOV_MAX
+#else
+#define WRITEV_MAX 1024
+#endif
+#define FOLLOW_BATCH_BYTES (64 * 1024)
+#define FOLLOW_BATCH_LINES 1024
+#define CHECKPOINT_INTERVAL 1.0 // seconds between state file writes
+#define IOBUF_DEFAULT (64 * 1024)
+#define IOBUF_AUTO_MAX (1024 * 1024)
+#define IOBUF_HUGE (2 * 1024 * 1024)
+#define IOBUF_MAX (256 * 1024 * 1024)
 
 typedef enum { COUNT_OK, COUNT_INVALID, COUNT_RANGE } count_e;
 typedef enum { MODE_LINES, MODE_BLOCKS, MODE_BYTES } mode_e;
@@ -27,22 +65,70 @@ typedef struct {
   bool follow;
   bool super_follow;
   bool reverse;
+  bool reverse_all;
   bool quiet;
   bool verbose;
   bool blocks;
+  bool lines_only;
+  double interval;
+  double latency;
+  char *state_path;
   count_t count;
 } flags_t;
 
 typedef struct {
-  char *buf;
-  size_t len;
-} line_t;
+  char *path;
+  int fd;
+  struct stat st;
+  off_t pos;
+  int wd;
+} follower_t;
 
+// One state file record: how far into which inode a followed path was sent.
 typedef struct {
-  size_t len;
-  size_t capacity;
-  line_t *data;
-} line_stack_t;
+  char *path;
+  dev_t dev;
+  ino_t ino;
+  off_t offset;
+} checkpoint_t;
+
+typedef struct {
+  char *path;
+  char *tmp_path;
+  checkpoint_t *entries;
+  size_t count;
+  bool dirty;
+  double saved_at;
+} state_t;
+
+static volatile sig_atomic_t follow_stop = 0;
+
+// -e literals. A line is printed when it contains any of them; with none
+// given every line is.
+typedef struct {
+  char **lit;
+  size_t *len;
+  size_t count;
+  bool match_all;
+} filter_t;
+
+static filter_t line_filter = {0};
+
+// Pipe-mode window over the last `want` lines. Bytes live in a circular
+// arena addressed by absolute stream offsets (pos % cap); `ends` is a
+// circular index of line end offsets, oldest first. Evicting the oldest
+// line just advances `head`.
+typedef struct {
+  char *buf;
+  size_t cap;
+  uint64_t head;
+  uint64_t tail;
+  uint64_t *ends;
+  size_t ends_cap;
+  size_t first;
+  size_t count;
+  size_t want;
+} line_ring_t;
 
 typedef struct {
   size_t start;
@@ -92,52 +178,10 @@ static void bytes_ring_append(bytes_ring_t *b, char *buf, size_t buf_len) {
   b->length = min_size(b->capacity, buf_len + b->length);
 }
 
-static void stack_init(line_stack_t *stack) {
-  stack->len = 0;
-  stack->capacity = 0;
-  stack->data = NULL;
-}
-
-static int stack_push(line_stack_t *stack, line_t elem) {
-  if (stack->len >= stack->capacity) {
-    size_t new_cap = stack->capacity == 0 ? 8 : stack->capacity * 2;
-    line_t *double_stack = realloc(stack->data, new_cap * sizeof(line_t));
-    if (double_stack == NULL) {
-      return -1;
-    }
-    stack->data = double_stack;
-    stack->capacity = new_cap;
-  }
-  stack->data[stack->len++] = elem;
-  return 0;
-}
-
-static line_t stack_pop(line_stack_t *stack) {
-  if (stack->len == 0) return (line_t){0};
-  return stack->data[--stack->len];
-}
-
-static void stack_free(line_stack_t *stack) {
-  for (size_t i = 0; i < stack->len; i++) {
-    free(stack->data[i].buf);
-  }
-  free(stack->data);
-  stack->data = NULL;
-  stack->len = 0;
-  stack->capacity = 0;
-}
-
-static void stack_drop_oldest(line_stack_t *stack) {
-  if (stack->len == 0) return;
-  free(stack->data[0].buf);
-  if (stack->len > 1) {
-    memmove(&stack->data[0], &stack->data[1], (stack->len - 1) * sizeof(line_t));
-  }
-  stack->len--;
-}
-
 static void usage(const char *progname) {
-  dprintf(STDERR_FILENO, "%s [-F | -f | -r] [-qv] [-b number | -c number | -n number] [file ...]\n",
+  dprintf(STDERR_FILENO,
+          "%s [-F | -f | -r] [-qv] [-s interval] [-L latency] [-P statefile] [-e pattern]\n"
+          "    [-b number | -c number | -n number] [file ...]\n",
           progname);
   exit(2);
 }
@@ -192,90 +236,625 @@ static int write_bytes(int outfd, char *bytes, size_t bytes_len) {
   return 0;
 }
 
-static int follow_fd(int fd, int outfd) {
-  if (lseek(fd, 0, SEEK_END) < 0) return -1;
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
 
-  char buf[64 * 1024];
-  for (;;) {
-    ssize_t n = read(fd, buf, sizeof(buf));
-    if (n > 0) {
-      if (write_bytes(outfd, buf, (size_t)n) < 0) {
-        return -1;
-      }
+static void dir_of(const char *path, char *dir, size_t size) {
+  const char *slash = strrchr(path, '/');
+  if (slash == NULL) {
+    snprintf(dir, size, ".");
+  } else if (slash == path) {
+    snprintf(dir, size, "/");
+  } else {
+    snprintf(dir, size, "%.*s", (int)(slash - path), path);
+  }
+}
+
+static void on_stop_signal(int sig) {
+  (void)sig;
+  follow_stop = 1;
+}
+
+// With a state file, a terminating signal ends the follow loop cleanly so
+// the final offsets are saved. No SA_RESTART: the signal must cut the wait.
+static void catch_stop_signals(void) {
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_stop_signal;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = 0;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGHUP, &sa, NULL);
+}
+
+static checkpoint_t *state_find(state_t *state, const char *path) {
+  for (size_t i = 0; i < state->count; i++) {
+    if (strcmp(state->entries[i].path, path) == 0) return &state->entries[i];
+  }
+  return NULL;
+}
+
+// Records where path stands, replacing any earlier record for it.
+static int state_put(state_t *state, const char *path, dev_t dev, ino_t ino, off_t offset) {
+  checkpoint_t *cp = state_find(state, path);
+  if (cp == NULL) {
+    checkpoint_t *grown = realloc(state->entries, (state->count + 1) * sizeof(*grown));
+    if (grown == NULL) return -1;
+    state->entries = grown;
+    char *copy = strdup(path);
+    if (copy == NULL) return -1;
+    cp = &state->entries[state->count++];
+    cp->path = copy;
+  }
+  cp->dev = dev;
+  cp->ino = ino;
+  cp->offset = offset;
+  return 0;
+}
+
+// Reads "dev ino offset path" records. A missing state file is an empty one.
+static int state_load(state_t *state) {
+  FILE *fp = fopen(state->path, "r");
+  if (fp == NULL) return errno == ENOENT ? 0 : -1;
+
+  char *line = NULL;
+  size_t line_cap = 0;
+  ssize_t len;
+  while ((len = getline(&line, &line_cap, fp)) > 0) {
+    if (line[len - 1] == '\n') line[len - 1] = '\0';
+    uintmax_t dev, ino;
+    intmax_t offset;
+    int path_at = 0;
+    if (sscanf(line, "%ju %ju %jd %n", &dev, &ino, &offset, &path_at) != 3 || path_at == 0 ||
+        line[path_at] == '\0' || offset < 0) {
       continue;
     }
-
-    if (n < 0) {
-      if (errno == EINTR) continue;
+    if (state_put(state, line + path_at, (dev_t)dev, (ino_t)ino, (off_t)offset) < 0) {
+      free(line);
+      fclose(fp);
+      errno = ENOMEM;
       return -1;
     }
+  }
+  free(line);
+  fclose(fp);
+  return 0;
+}
 
-    struct stat st;
-    if (fstat(fd, &st) < 0) return -1;
+// Replaces the state file with the current offsets. Records for paths not
+// followed in this run, or whose file is not open right now, keep their
+// last known offset. The records go to a temporary file that is synced and
+// renamed over the old one, so a crash leaves either the previous
+// checkpoint or the new one, never a mix.
+static int state_save(state_t *state, const follower_t *fs, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    const follower_t *f = &fs[i];
+    if (f->fd < 0) continue;
+    if (state_put(state, f->path, f->st.st_dev, f->st.st_ino, f->pos) < 0) return -1;
+  }
 
-    off_t pos = lseek(fd, 0, SEEK_CUR);
-    if (pos < 0) return -1;
+  int fd = open(state->tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) return -1;
 
-    if (pos > st.st_size) {
-      if (lseek(fd, 0, SEEK_SET) < 0) return -1;
+  int rc = 0;
+  for (size_t i = 0; i < state->count && rc == 0; i++) {
+    const checkpoint_t *cp = &state->entries[i];
+    if (strchr(cp->path, '\n') != NULL) continue;
+    if (dprintf(fd, "%ju %ju %jd %s\n", (uintmax_t)cp->dev, (uintmax_t)cp->ino,
+                (intmax_t)cp->offset, cp->path) < 0) {
+      rc = -1;
     }
-
-    sleep(1);
   }
+  if (rc == 0 && fdatasync(fd) < 0) rc = -1;
+  int saved = errno;
+  if (close(fd) < 0 && rc == 0) {
+    saved = errno;
+    rc = -1;
+  }
+  if (rc == 0 && rename(state->tmp_path, state->path) < 0) {
+    saved = errno;
+    rc = -1;
+  }
+  if (rc < 0) {
+    unlink(state->tmp_path);
+    errno = saved;
+    return -1;
+  }
+  state->dirty = false;
+  state->saved_at = now_seconds();
+  return 0;
 }
 
-static int follow_name(const char *path, int *fd, int outfd) {
-  if (lseek(*fd, 0, SEEK_END) < 0) return -1;
+static int watch_open(void) {
+#ifdef __linux__
+  return inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#else
+  return -1;
+#endif
+}
 
-  struct stat current;
-  if (fstat(*fd, &current) < 0) return -1;
+// Asks inotify to wake us when the file changes and, when following by
+// name, when something is created or moved into its directory. Returns the
+// file's watch descriptor, or -1 if it is not watched.
+static int watch_add(int ifd, const char *path, bool by_name) {
+#ifdef __linux__
+  if (ifd < 0) return -1;
+  int wd = inotify_add_watch(ifd, path, IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+  if (!by_name) return wd;
+
+  char dir[PATH_MAX];
+  dir_of(path, dir, sizeof(dir));
+  inotify_add_watch(ifd, dir, IN_CREATE | IN_MOVED_TO);
+  return wd;
+#else
+  (void)ifd;
+  (void)path;
+  (void)by_name;
+  return -1;
+#endif
+}
 
-  char buf[64 * 1024];
+// Drops the watch on a file we no longer read. The kernel may already have
+// removed it if the file was deleted, so failure is ignored.
+static void watch_remove(int ifd, int wd) {
+#ifdef __linux__
+  if (ifd >= 0 && wd >= 0) inotify_rm_watch(ifd, wd);
+#else
+  (void)ifd;
+  (void)wd;
+#endif
+}
 
+// Blocks until inotify reports a change or the interval runs out. Without
+// inotify this is a plain sleep, so -s still bounds the polling rate.
+static int watch_wait(int ifd, double interval) {
+  if (ifd < 0) {
+    struct timespec ts;
+    ts.tv_sec = (time_t)interval;
+    ts.tv_nsec = (long)((interval - (double)ts.tv_sec) * 1e9);
+    while (nanosleep(&ts, &ts) < 0) {
+      if (errno != EINTR) return -1;
+      if (follow_stop) break;
+    }
+    return 0;
+  }
+
+  struct pollfd pfd = {.fd = ifd, .events = POLLIN};
+  int rc = poll(&pfd, 1, (int)(interval * 1000 + 0.999));
+  if (rc < 0 && errno != EINTR) return -1;
+
+  char events[4096];
+  while (read(ifd, events, sizeof(events)) > 0) {
+  }
+  return 0;
+}
+
+static const char *last_newline(const char *p, size_t len) {
+#ifdef __GLIBC__
+  return memrchr(p, '\n', len);
+#else
+  while (len > 0) {
+    if (p[--len] == '\n') return p + len;
+  }
+  return NULL;
+#endif
+}
+
+static bool filtering(void) {
+  return line_filter.count > 0;
+}
+
+// Adds the literals of one -e argument; like grep, a newline separates
+// several of them.
+static int filter_add(const char *arg) {
   for (;;) {
-    ssize_t n = read(*fd, buf, sizeof(buf));
-    if (n > 0) {
-      if (write_bytes(outfd, buf, (size_t)n) < 0) {
-        return -1;
-      }
-      continue;
+    const char *nl = strchr(arg, '\n');
+    size_t len = nl != NULL ? (size_t)(nl - arg) : strlen(arg);
+    char **lit = realloc(line_filter.lit, (line_filter.count + 1) * sizeof(*lit));
+    if (lit == NULL) return -1;
+    line_filter.lit = lit;
+    size_t *lens = realloc(line_filter.len, (line_filter.count + 1) * sizeof(*lens));
+    if (lens == NULL) return -1;
+    line_filter.len = lens;
+    char *copy = strndup(arg, len);
+    if (copy == NULL) return -1;
+    line_filter.lit[line_filter.count] = copy;
+    line_filter.len[line_filter.count] = len;
+    line_filter.count++;
+    if (len == 0) line_filter.match_all = true;
+    if (nl == NULL) return 0;
+    arg = nl + 1;
+  }
+}
+
+// True when some literal occurs at q, which has rest bytes left.
+static bool filter_verify(const char *q, size_t rest) {
+  for (size_t k = 0; k < line_filter.count; k++) {
+    size_t len = line_filter.len[k];
+    if (len <= rest && memcmp(q, line_filter.lit[k], len) == 0) return true;
+  }
+  return false;
+}
+
+typedef const char *(*filter_kernel_fn)(const char *p, size_t len);
+
+static const char *filter_find_scalar(const char *p, size_t len) {
+  const char *best = NULL;
+  for (size_t k = 0; k < line_filter.count; k++) {
+    size_t span = best != NULL ? (size_t)(best - p) + line_filter.len[k] : len;
+    const char *hit = memmem(p, min_size(span, len), line_filter.lit[k], line_filter.len[k]);
+    if (hit != NULL && (best == NULL || hit < best)) best = hit;
+  }
+  return best;
+}
+
+// The vector kernels compare every position against the first two bytes
+// of each literal (a one-byte literal only needs the first) and only run
+// memcmp where such a prefix lines up.
+#if defined(__SSE2__)
+static const char *filter_find_sse2(const char *p, size_t len) {
+  const __m128i ones = _mm_set1_epi8(-1);
+  size_t off = 0;
+  for (; off + 17 <= len; off += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(p + off));
+    __m128i b = _mm_loadu_si128((const __m128i *)(p + off + 1));
+    unsigned bits = 0;
+    for (size_t k = 0; k < line_filter.count; k++) {
+      const char *lit = line_filter.lit[k];
+      __m128i first = _mm_cmpeq_epi8(a, _mm_set1_epi8(lit[0]));
+      __m128i second = line_filter.len[k] > 1 ? _mm_cmpeq_epi8(b, _mm_set1_epi8(lit[1])) : ones;
+      bits |= (unsigned)_mm_movemask_epi8(_mm_and_si128(first, second));
+    }
+    for (; bits != 0; bits &= bits - 1) {
+      size_t at = off + (size_t)__builtin_ctz(bits);
+      if (filter_verify(p + at, len - at)) return p + at;
+    }
+  }
+  return filter_find_scalar(p + off, len - off);
+}
+#endif
+
+#ifdef HAVE_AVX2_KERNEL
+__attribute__((target("avx2"))) static const char *filter_find_avx2(const char *p, size_t len) {
+  const __m256i ones = _mm256_set1_epi8(-1);
+  size_t off = 0;
+  for (; off + 33 <= len; off += 32) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(p + off));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(p + off + 1));
+    uint32_t bits = 0;
+    for (size_t k = 0; k < line_filter.count; k++) {
+      const char *lit = line_filter.lit[k];
+      __m256i first = _mm256_cmpeq_epi8(a, _mm256_set1_epi8(lit[0]));
+      __m256i second =
+          line_filter.len[k] > 1 ? _mm256_cmpeq_epi8(b, _mm256_set1_epi8(lit[1])) : ones;
+      bits |= (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(first, second));
+    }
+    for (; bits != 0; bits &= bits - 1) {
+      size_t at = off + (size_t)__builtin_ctz(bits);
+      if (filter_verify(p + at, len - at)) return p + at;
+    }
+  }
+  return filter_find_scalar(p + off, len - off);
+}
+#endif
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+static const char *filter_find_neon(const char *p, size_t len) {
+  const uint8x16_t ones = vdupq_n_u8(0xff);
+  size_t off = 0;
+  for (; off + 17 <= len; off += 16) {
+    uint8x16_t a = vld1q_u8((const uint8_t *)p + off);
+    uint8x16_t b = vld1q_u8((const uint8_t *)p + off + 1);
+    uint8x16_t hits = vdupq_n_u8(0);
+    for (size_t k = 0; k < line_filter.count; k++) {
+      const char *lit = line_filter.lit[k];
+      uint8x16_t first = vceqq_u8(a, vdupq_n_u8((uint8_t)lit[0]));
+      uint8x16_t second = line_filter.len[k] > 1 ? vceqq_u8(b, vdupq_n_u8((uint8_t)lit[1])) : ones;
+      hits = vorrq_u8(hits, vandq_u8(first, second));
+    }
+    // narrow to 4 bits per byte so the block fits a 64-bit mask
+    uint8x8_t narrowed = vshrn_n_u16(vreinterpretq_u16_u8(hits), 4);
+    uint64_t bits = vget_lane_u64(vreinterpret_u64_u8(narrowed), 0);
+    for (; bits != 0; bits &= ~((uint64_t)0xf << __builtin_ctzll(bits))) {
+      size_t at = off + (size_t)__builtin_ctzll(bits) / 4;
+      if (filter_verify(p + at, len - at)) return p + at;
     }
+  }
+  return filter_find_scalar(p + off, len - off);
+}
+#endif
+
+static filter_kernel_fn filter_kernel = NULL;
+
+static void filter_kernel_init(void) {
+  filter_kernel = filter_find_scalar;
+#if defined(__SSE2__)
+  filter_kernel = filter_find_sse2;
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  filter_kernel = filter_find_neon;
+#endif
+#ifdef HAVE_AVX2_KERNEL
+  if (__builtin_cpu_supports("avx2")) filter_kernel = filter_find_avx2;
+#endif
+}
+
+// Returns the first line of p[0, len) that passes the filter and stores its
+// length, newline included, in *line_len. NULL when no line matches.
+static const char *filter_next(const char *p, size_t len, size_t *line_len) {
+  if (len == 0) return NULL;
+  const char *hit = p;
+  if (!line_filter.match_all) {
+    if (filter_kernel == NULL) filter_kernel_init();
+    hit = filter_kernel(p, len);
+    if (hit == NULL) return NULL;
+  }
+  const char *nl = last_newline(p, (size_t)(hit - p));
+  const char *start = nl != NULL ? nl + 1 : p;
+  const char *end = memchr(hit, '\n', len - (size_t)(hit - p));
+  *line_len = (end != NULL ? (size_t)(end - start) + 1 : (size_t)(p + len - start));
+  return start;
+}
+
+static bool filter_line(const char *line, size_t len) {
+  size_t line_len;
+  return !filtering() || filter_next(line, len, &line_len) != NULL;
+}
+
+static void print_header(const char *path, bool first) {
+  dprintf(STDOUT_FILENO, "%s==> %s <==\n", first ? "" : "\n", path);
+}
+
+// Where followed data goes: which file last produced output (for headers)
+// and whether the output still accepts splice(2). With -L, complete lines
+// are held in batch until a budget fills or the oldest one is latency old.
+typedef struct {
+  int fd;
+  bool headers;
+  bool splice_ok;
+  size_t active;
+  bool lines_only;
+  double latency;
+  char *batch;
+  size_t len;
+  size_t lines;
+  double first;
+} follow_out_t;
+
+static int follow_flush(follow_out_t *out) {
+  if (out->len == 0) return 0;
+  int rc = write_bytes(out->fd, out->batch, out->len);
+  out->len = 0;
+  out->lines = 0;
+  return rc;
+}
 
+static int follow_batch(follow_out_t *out, const char *p, size_t len, size_t lines) {
+  if (out->len + len > FOLLOW_BATCH_BYTES && follow_flush(out) < 0) return -1;
+  if (out->len == 0) out->first = now_seconds();
+  memcpy(out->batch + out->len, p, len);
+  out->len += len;
+  out->lines += lines;
+  if (out->len == FOLLOW_BATCH_BYTES || out->lines >= FOLLOW_BATCH_LINES) return follow_flush(out);
+  return 0;
+}
+
+// -L: queues only the complete lines appended to f. The position stays on
+// a line boundary, so an unfinished line is picked up again once its
+// newline arrives; a line longer than the batch goes out in pieces.
+static int follow_drain_lines(follower_t *f, size_t idx, follow_out_t *out, off_t end,
+                              bool *progressed) {
+  char buf[FOLLOW_BATCH_BYTES];
+  while (f->pos < end) {
+    size_t want = min_size(sizeof(buf), (size_t)(end - f->pos));
+    ssize_t n = pread(f->fd, buf, want, f->pos);
     if (n < 0) {
       if (errno == EINTR) continue;
       return -1;
     }
+    if (n == 0) break;
 
-    struct stat path_st;
-    if (stat(path, &path_st) == 0) {
-      if (!same_file(&current, &path_st)) {
-        int newfd = open(path, O_RDONLY);
-        if (newfd >= 0) {
-          if (close(*fd) < 0) {
-            int saved = errno;
-            close(newfd);
-            errno = saved;
-            return -1;
-          }
-          *fd = newfd;
-
-          if (fstat(*fd, &current) < 0) return -1;
-        }
+    const char *nl = last_newline(buf, (size_t)n);
+    size_t take;
+    if (nl != NULL) {
+      take = (size_t)(nl - buf) + 1;
+    } else if ((size_t)n == sizeof(buf)) {
+      take = sizeof(buf);
+    } else {
+      break;
+    }
+
+    size_t done = 0;
+    size_t line_len = take;
+    const char *line = buf;
+    while (done < take) {
+      if (filtering()) {
+        line = filter_next(buf + done, take - done, &line_len);
+        if (line == NULL) break;
+      }
+      if (out->headers && out->active != idx) {
+        char header[PATH_MAX + 16];
+        int hlen = snprintf(header, sizeof(header), "\n==> %s <==\n", f->path);
+        if (hlen < 0) return -1;
+        size_t hsize = min_size((size_t)hlen, sizeof(header) - 1);
+        if (follow_batch(out, header, hsize, 0) < 0) return -1;
+        out->active = idx;
       }
-    } else if (errno != ENOENT) {
+
+      size_t lines = 0;
+      const char *e = line + line_len;
+      for (const char *p = line; (p = memchr(p, '\n', (size_t)(e - p))) != NULL; p++) lines++;
+      if (follow_batch(out, line, line_len, lines) < 0) return -1;
+      done = (size_t)(e - buf);
+    }
+    f->pos += (off_t)take;
+    *progressed = true;
+    if (take < (size_t)n) break;
+  }
+  return 0;
+}
+
+// Moves [f->pos, end) straight from the page cache into the output pipe.
+// Returns 1 when the kernel refuses splice here so the caller can fall back
+// to copying, 0 once the range (or whatever is readable of it) is sent.
+static int follow_splice(follower_t *f, off_t end, int outfd, bool *progressed) {
+#ifdef __linux__
+  while (f->pos < end) {
+    loff_t off = f->pos;
+    size_t want = min_size((size_t)(end - f->pos), (size_t)1 << 30);
+    ssize_t n = splice(f->fd, &off, outfd, NULL, want, SPLICE_F_MOVE);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP) return 1;
       return -1;
     }
+    if (n == 0) break;
+    f->pos = (off_t)off;
+    *progressed = true;
+  }
+  return 0;
+#else
+  (void)f;
+  (void)end;
+  (void)outfd;
+  (void)progressed;
+  return 1;
+#endif
+}
 
-    struct stat st;
-    if (fstat(*fd, &st) < 0) return -1;
+// Copies whatever was appended to f since the last pass. A file that got
+// shorter was truncated and is read again from the start.
+static int follow_drain(follower_t *f, size_t idx, follow_out_t *out, bool *progressed) {
+  struct stat st;
+  if (fstat(f->fd, &st) < 0) return -1;
+  if (st.st_size < f->pos) f->pos = 0;
+  if (f->pos >= st.st_size) return 0;
+  if (out->lines_only) return follow_drain_lines(f, idx, out, st.st_size, progressed);
+
+  if (out->headers && out->active != idx) {
+    print_header(f->path, false);
+    out->active = idx;
+  }
 
-    off_t pos = lseek(*fd, 0, SEEK_CUR);
-    if (pos < 0) return -1;
+  if (out->splice_ok) {
+    int rc = follow_splice(f, st.st_size, out->fd, progressed);
+    if (rc <= 0) return rc;
+    out->splice_ok = false;
+  }
 
-    if (pos > st.st_size) {
-      if (lseek(*fd, 0, SEEK_SET) < 0) return -1;
+  char buf[64 * 1024];
+  while (f->pos < st.st_size) {
+    size_t want = min_size(sizeof(buf), (size_t)(st.st_size - f->pos));
+    ssize_t n = pread(f->fd, buf, want, f->pos);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    if (n == 0) break;
+    if (write_bytes(out->fd, buf, (size_t)n) < 0) return -1;
+    f->pos += n;
+    *progressed = true;
+  }
+  return 0;
+}
+
+// -F: if the name now points at a different file (rotation, or the file
+// reappeared), switch to it and start reading it from the beginning.
+static int follow_reopen(follower_t *f, int ifd, bool *progressed) {
+  struct stat path_st;
+  if (stat(f->path, &path_st) < 0) return errno == ENOENT ? 0 : -1;
+  if (f->fd >= 0 && same_file(&f->st, &path_st)) return 0;
+
+  int newfd = open(f->path, O_RDONLY);
+  if (newfd < 0) return 0;
+  if (f->fd >= 0 && close(f->fd) < 0) {
+    int saved = errno;
+    close(newfd);
+    errno = saved;
+    return -1;
+  }
+  f->fd = newfd;
+  if (fstat(f->fd, &f->st) < 0) return -1;
+  f->pos = 0;
+  // the old inode (now app.log.1 or similar) must not keep waking us
+  watch_remove(ifd, f->wd);
+  f->wd = watch_add(ifd, f->path, false);
+  *progressed = true;
+  return 0;
+}
+
+// Follows every file from one loop: each pass drains whatever was appended
+// to any of them and only waits when none changed. A header is printed
+// whenever output switches to a different file. With a state file the
+// offsets are checkpointed at most every CHECKPOINT_INTERVAL, and a
+// terminating signal returns after a final checkpoint; errors exit.
+static void follow_files(char *progname, follower_t *fs, size_t n, flags_t flags, size_t active,
+                         state_t *state) {
+  bool by_name = flags.super_follow;
+  int ifd = watch_open();
+
+  struct stat out_st;
+  follow_out_t out = {.fd = STDOUT_FILENO, .headers = !flags.quiet, .active = active};
+  out.splice_ok = fstat(out.fd, &out_st) == 0 && S_ISFIFO(out_st.st_mode);
+  if (flags.lines_only || filtering()) {
+    // the filter needs whole lines; without -L they go out on every pass
+    out.lines_only = true;
+    out.latency = flags.lines_only ? flags.latency : 0;
+    out.splice_ok = false;
+    out.batch = malloc(FOLLOW_BATCH_BYTES);
+    if (out.batch == NULL) error_errno(progname, errno, "malloc");
+  }
+  for (size_t i = 0; i < n; i++) fs[i].wd = watch_add(ifd, fs[i].path, by_name);
+
+  for (;;) {
+    if (follow_stop) {
+      if (follow_flush(&out) < 0) error_errno(progname, errno, "stdout");
+      if (state != NULL && state_save(state, fs, n) < 0) {
+        error_errno(progname, errno, state->path);
+      }
+      free(out.batch);
+      return;
+    }
+
+    bool progressed = false;
+    for (size_t i = 0; i < n; i++) {
+      follower_t *f = &fs[i];
+      if (f->fd >= 0 && follow_drain(f, i, &out, &progressed) < 0) {
+        error_errno(progname, errno, f->path);
+      }
+      if (by_name && follow_reopen(f, ifd, &progressed) < 0) {
+        error_errno(progname, errno, f->path);
+      }
+    }
+
+    double wait = flags.interval;
+    if (out.len > 0) {
+      double left = out.first + out.latency - now_seconds();
+      if (left <= 0) {
+        if (follow_flush(&out) < 0) error_errno(progname, errno, "stdout");
+      } else if (left < wait) {
+        wait = left;
+      }
+    }
+    if (state != NULL) {
+      if (progressed) state->dirty = true;
+      if (state->dirty) {
+        // Offsets may only cover bytes that have actually been written.
+        double left = state->saved_at + CHECKPOINT_INTERVAL - now_seconds();
+        if (left <= 0) {
+          if (follow_flush(&out) < 0) error_errno(progname, errno, "stdout");
+          if (state_save(state, fs, n) < 0) error_errno(progname, errno, state->path);
+        } else if (left < wait) {
+          wait = left;
+        }
+      }
+    }
+    if (!progressed && watch_wait(ifd, wait) < 0) {
+      error_errno(progname, errno, "poll");
     }
-    sleep(1);
   }
 }
 
@@ -303,135 +882,209 @@ static int write_bytes_ring(int outfd, bytes_ring_t *br) {
   return 0;
 }
 
-static int write_lines(int outfd, flags_t flags, line_stack_t *s) {
-  size_t wanted = flags.count.as.lines;
-  size_t have = s->len;
-  size_t len = wanted <= have ? wanted : have;
+static int flush_iov(int outfd, struct iovec *iov, int cnt) {
+  while (cnt > 0) {
+    ssize_t n = writev(outfd, iov, cnt);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    while (cnt > 0 && (size_t)n >= iov->iov_len) {
+      n -= (ssize_t)iov->iov_len;
+      iov++;
+      cnt--;
+    }
+    if (cnt > 0) {
+      iov->iov_base = (char *)iov->iov_base + n;
+      iov->iov_len -= (size_t)n;
+    }
+  }
+  return 0;
+}
+
+static void line_ring_free(line_ring_t *r) {
+  free(r->buf);
+  free(r->ends);
+  memset(r, 0, sizeof(*r));
+}
 
-  if (flags.reverse) {
-    for (size_t i = 0; i < len; i++) {
-      line_t out = stack_pop(s);
-      int r = write_bytes(outfd, out.buf, out.len);
-      free(out.buf);
-      if (r < 0) return -1;
+static void arena_put(char *buf, size_t cap, uint64_t pos, const char *src, size_t len) {
+  size_t idx = (size_t)(pos % cap);
+  size_t first = min_size(len, cap - idx);
+  memcpy(buf + idx, src, first);
+  memcpy(buf, src + first, len - first);
+}
+
+static int line_ring_too_big(const line_ring_t *r) {
+  fprintf(stderr, "tail: last %zu lines need more than %zu bytes of memory\n", r->want,
+          LINE_ARENA_MAX);
+  errno = ENOMEM;
+  return -1;
+}
+
+// Makes room for `need` retained bytes, moving what is still live from
+// [head, tail) into a larger arena. The arena and the line index share
+// LINE_ARENA_MAX; past it this fails instead of growing without bound.
+static int line_ring_reserve(line_ring_t *r, size_t need) {
+  if (need <= r->cap) return 0;
+
+  size_t limit = LINE_ARENA_MAX - r->ends_cap * sizeof(*r->ends);
+  size_t cap = r->cap == 0 ? LINE_ARENA_MIN : r->cap;
+  while (cap < need) cap *= 2;
+  if (cap > limit) {
+    if (need > limit) return line_ring_too_big(r);
+    cap = limit;
+  }
+
+  char *buf = malloc(cap);
+  if (buf == NULL) return -1;
+  if (r->head < r->tail) {
+    uint64_t pos = r->head;
+    while (pos < r->tail) {
+      size_t idx = (size_t)(pos % r->cap);
+      size_t len = min_size((size_t)(r->tail - pos), r->cap - idx);
+      arena_put(buf, cap, pos, r->buf + idx, len);
+      pos += len;
     }
+  }
+  free(r->buf);
+  r->buf = buf;
+  r->cap = cap;
+  return 0;
+}
+
+static int line_ring_push_end(line_ring_t *r, uint64_t end) {
+  if (r->want == 0) {
+    r->head = end;
     return 0;
   }
+  if (r->count == r->want) {
+    r->head = r->ends[r->first];
+    r->first = (r->first + 1) % r->ends_cap;
+    r->count--;
+  }
+  if (r->count == r->ends_cap) {
+    size_t cap = r->ends_cap == 0 ? 64 : r->ends_cap * 2;
+    if (cap > r->want) cap = r->want;
+    if (cap > (LINE_ARENA_MAX - r->cap) / sizeof(*r->ends)) return line_ring_too_big(r);
+    uint64_t *ends = malloc(cap * sizeof(*ends));
+    if (ends == NULL) return -1;
+    for (size_t i = 0; i < r->count; i++) ends[i] = r->ends[(r->first + i) % r->ends_cap];
+    free(r->ends);
+    r->ends = ends;
+    r->ends_cap = cap;
+    r->first = 0;
+  }
+  r->ends[(r->first + r->count) % r->ends_cap] = end;
+  r->count++;
+  return 0;
+}
+
+static int line_ring_append(line_ring_t *r, const char *data, size_t n) {
+  uint64_t base = r->tail;
+  const char *p = data;
+  const char *nl;
+  while ((nl = memchr(p, '\n', n - (size_t)(p - data))) != NULL) {
+    if (line_ring_push_end(r, base + (uint64_t)(nl - data) + 1) < 0) return -1;
+    p = nl + 1;
+  }
 
-  size_t start = have > len ? have - len : 0;
-  for (size_t i = start; i < have; i++) {
-    int r = write_bytes(outfd, s->data[i].buf, s->data[i].len);
-    if (r < 0) return -1;
+  uint64_t new_tail = base + n;
+  if (r->head > r->tail) r->tail = r->head;
+  if (line_ring_reserve(r, (size_t)(new_tail - r->head)) < 0) return -1;
+  uint64_t keep = r->head > base ? r->head : base;
+  if (keep < new_tail) {
+    arena_put(r->buf, r->cap, keep, data + (keep - base), (size_t)(new_tail - keep));
   }
+  r->tail = new_tail;
   return 0;
 }
 
-static int stream_copy(int infd, int outfd, flags_t flags) {
-  char buf[64 * 1024];
+// Queues the ring bytes [start, end) as one or two iovecs (the range may
+// wrap). With a filter, a line that does not match queues nothing.
+static int line_ring_queue(int outfd, const line_ring_t *r, uint64_t start, uint64_t end,
+                           struct iovec *iov, int *cnt) {
+  if (filtering()) {
+    size_t idx = (size_t)(start % r->cap);
+    size_t len = (size_t)(end - start);
+    bool match;
+    if (idx + len <= r->cap) {
+      match = filter_line(r->buf + idx, len);
+    } else {
+      char *line = malloc(len);
+      if (line == NULL) return -1;
+      memcpy(line, r->buf + idx, r->cap - idx);
+      memcpy(line + (r->cap - idx), r->buf, len - (r->cap - idx));
+      match = filter_line(line, len);
+      free(line);
+    }
+    if (!match) return 0;
+  }
+  while (start < end) {
+    size_t idx = (size_t)(start % r->cap);
+    size_t len = min_size((size_t)(end - start), r->cap - idx);
+    iov[*cnt].iov_base = r->buf + idx;
+    iov[*cnt].iov_len = len;
+    if (++*cnt == WRITEV_MAX) {
+      if (flush_iov(outfd, iov, *cnt) < 0) return -1;
+      *cnt = 0;
+    }
+    start += len;
+  }
+  return 0;
+}
+
+static int line_ring_write(int outfd, const line_ring_t *r, bool reverse) {
+  if (!reverse && !filtering()) {
+    uint64_t pos = r->head;
+    while (pos < r->tail) {
+      size_t idx = (size_t)(pos % r->cap);
+      size_t len = min_size((size_t)(r->tail - pos), r->cap - idx);
+      if (write_bytes(outfd, r->buf + idx, len) < 0) return -1;
+      pos += len;
+    }
+    return 0;
+  }
+
+  struct iovec iov[WRITEV_MAX];
+  int cnt = 0;
+  for (size_t n = 1; n <= r->count; n++) {
+    size_t i = reverse ? r->count - n + 1 : n;
+    uint64_t end = r->ends[(r->first + i - 1) % r->ends_cap];
+    uint64_t start = i > 1 ? r->ends[(r->first + i - 2) % r->ends_cap] : r->head;
+    if (line_ring_queue(outfd, r, start, end, iov, &cnt) < 0) return -1;
+  }
+  return flush_iov(outfd, iov, cnt);
+}
+
+static int stream_copy_buf(int infd, int outfd, flags_t flags, char *buf, size_t buf_len) {
   switch (flags.count.mode) {
   case MODE_LINES: {
-    size_t want = flags.count.as.lines;
-    line_stack_t lines = {0};
-    stack_init(&lines);
-    char *carry = NULL;
-    size_t carry_len = 0;
-
+    line_ring_t ring = {.want = flags.count.as.lines};
     for (;;) {
-      ssize_t n = read(infd, buf, sizeof(buf));
+      ssize_t n = read(infd, buf, buf_len);
       if (n < 0) {
         if (errno == EINTR) continue;
         int saved = errno;
-        free(carry);
-        stack_free(&lines);
+        line_ring_free(&ring);
         errno = saved;
         return -1;
       }
 
+      int r = 0;
       if (n == 0) {
-        if (carry_len > 0) {
-          char *line = malloc(carry_len);
-          if (line == NULL) {
-            int saved = errno;
-            free(carry);
-            stack_free(&lines);
-            errno = saved;
-            return -1;
-          }
-          memcpy(line, carry, carry_len);
-
-          if (want > 0) {
-            if (lines.len == want) stack_drop_oldest(&lines);
-            if (stack_push(&lines, (line_t){.buf = line, .len = carry_len}) < 0) {
-              int saved = errno;
-              free(carry);
-              stack_free(&lines);
-              errno = saved;
-              return -1;
-            }
-          } else {
-            free(line);
-          }
-        }
-
-        free(carry);
-        int r = write_lines(outfd, flags, &lines);
-        stack_free(&lines);
-        return r;
+        uint64_t last = ring.count > 0 ? ring.ends[(ring.first + ring.count - 1) % ring.ends_cap]
+                                       : ring.head;
+        if (ring.tail > last) r = line_ring_push_end(&ring, ring.tail);
+        if (r == 0) r = line_ring_write(outfd, &ring, flags.reverse);
+      } else {
+        r = line_ring_append(&ring, buf, (size_t)n);
       }
-      char *p = buf;
-      size_t remaining = (size_t)n;
-
-      while (remaining > 0) {
-        char *nl = memchr(p, '\n', remaining);
-
-        if (nl == NULL) {
-          char *new_carry = realloc(carry, carry_len + remaining);
-          if (new_carry == NULL) {
-            int saved = errno;
-            free(carry);
-            stack_free(&lines);
-            errno = saved;
-            return -1;
-          }
-          carry = new_carry;
-          memcpy(carry + carry_len, p, remaining);
-          carry_len += remaining;
-          break;
-        }
-
-        size_t seg_len = (size_t)(nl - p) + 1;
-        size_t line_len = carry_len + seg_len;
-        char *line = malloc(line_len);
-        if (line == NULL) {
-          int saved = errno;
-          free(carry);
-          stack_free(&lines);
-          errno = saved;
-          return -1;
-        }
-
-        if (carry_len > 0) memcpy(line, carry, carry_len);
-        memcpy(line + carry_len, p, seg_len);
-
-        free(carry);
-        carry = NULL;
-        carry_len = 0;
-
-        if (want > 0) {
-          if (lines.len == want) stack_drop_oldest(&lines);
-          if (stack_push(&lines, (line_t){.buf = line, .len = line_len}) < 0) {
-            int saved = errno;
-            free(carry);
-            stack_free(&lines);
-            errno = saved;
-            return -1;
-          }
-        } else {
-          free(line);
-        }
-
-        p += seg_len;
-        remaining -= seg_len;
+      if (r < 0 || n == 0) {
+        int saved = errno;
+        line_ring_free(&ring);
+        errno = saved;
+        return r;
       }
     }
   }
@@ -442,7 +1095,7 @@ static int stream_copy(int infd, int outfd, flags_t flags) {
     bytes_ring_init(&br, want);
     if (br.buf == NULL) return -1;
     for (;;) {
-      ssize_t n = read(infd, buf, sizeof(buf));
+      ssize_t n = read(infd, buf, buf_len);
       if (n < 0) {
         if (errno == EINTR) continue;
         bytes_ring_free(&br);
@@ -475,7 +1128,7 @@ static int stream_copy(int infd, int outfd, flags_t flags) {
     bytes_ring_init(&br, want * BLOCK_SIZE);
     if (br.buf == NULL) return -1;
     for (;;) {
-      ssize_t n = read(infd, buf, sizeof(buf));
+      ssize_t n = read(infd, buf, buf_len);
       if (n < 0) {
         if (errno == EINTR) continue;
         bytes_ring_free(&br);
@@ -502,10 +1155,131 @@ static int stream_copy(int infd, int outfd, flags_t flags) {
   return 0;
 }
 
-static ssize_t read_to_buffer(int fd, char *buf, size_t want) {
+typedef struct {
+  uint8_t *p;
+  size_t len;
+  size_t map_len;
+} iobuf_t;
+
+static size_t iobuf_env_size(void) {
+  const char *s = getenv("CORE_UTILS_BUFSIZE");
+  // strtoull would take "-1" and wrap it; only plain digits are a size
+  if (s == NULL || *s < '0' || *s > '9') return 0;
+
+  // out-of-range values saturate at ULLONG_MAX and are clamped below
+  char *end = NULL;
+  unsigned long long val = strtoull(s, &end, 10);
+  if (end == s) return 0;
+  unsigned shift = 0;
+  if (*end == 'k' || *end == 'K') {
+    shift = 10;
+    end++;
+  } else if (*end == 'm' || *end == 'M') {
+    shift = 20;
+    end++;
+  }
+  if (*end != '\0') return 0;
+  if (val > ((unsigned long long)IOBUF_MAX >> shift)) return IOBUF_MAX;
+  return (size_t)val << shift;
+}
+
+// Buffer size for pipe input: CORE_UTILS_BUFSIZE if set, else the largest
+// of the default, st_blksize and pipe capacity. An explicit size also grows
+// our pipes to match; auto sizing leaves them alone.
+static size_t iobuf_size(int infd, int outfd) {
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t want = iobuf_env_size();
+  bool explicit_size = want != 0;
+  int fds[2] = {infd, outfd};
+
+  if (!explicit_size) {
+    want = IOBUF_DEFAULT;
+    for (size_t i = 0; i < 2; i++) {
+      struct stat st;
+      if (fstat(fds[i], &st) < 0) continue;
+      if (st.st_blksize > 0 && (size_t)st.st_blksize > want) want = (size_t)st.st_blksize;
+#ifdef F_GETPIPE_SZ
+      if (S_ISFIFO(st.st_mode)) {
+        int cap = fcntl(fds[i], F_GETPIPE_SZ);
+        if (cap > 0 && (size_t)cap > want) want = (size_t)cap;
+      }
+#endif
+    }
+    if (want > IOBUF_AUTO_MAX) want = IOBUF_AUTO_MAX;
+  }
+
+  if (want < page) want = page;
+  want = (want + page - 1) / page * page;
+
+#ifdef F_SETPIPE_SZ
+  if (explicit_size) {
+    for (size_t i = 0; i < 2; i++) {
+      struct stat st;
+      if (fstat(fds[i], &st) < 0 || !S_ISFIFO(st.st_mode)) continue;
+      int cap = fcntl(fds[i], F_GETPIPE_SZ);
+      if (cap > 0 && (size_t)cap < want) fcntl(fds[i], F_SETPIPE_SZ, (int)want);
+    }
+  }
+#endif
+  return want;
+}
+
+static int iobuf_alloc(iobuf_t *b, size_t len) {
+  b->len = len;
+  b->map_len = 0;
+#ifdef MAP_ANONYMOUS
+  if (len >= IOBUF_HUGE) {
+    size_t map_len = (len + IOBUF_HUGE - 1) / IOBUF_HUGE * IOBUF_HUGE;
+    uint8_t *raw = mmap(NULL, map_len + IOBUF_HUGE, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw != MAP_FAILED) {
+      size_t lead = (IOBUF_HUGE - (uintptr_t)raw % IOBUF_HUGE) % IOBUF_HUGE;
+      if (lead > 0) munmap(raw, lead);
+      munmap(raw + lead + map_len, IOBUF_HUGE - lead);
+      b->p = raw + lead;
+      b->map_len = map_len;
+#ifdef MADV_HUGEPAGE
+      madvise(b->p, b->map_len, MADV_HUGEPAGE);
+#endif
+      return 0;
+    }
+  }
+#endif
+  void *p = NULL;
+  int rc = posix_memalign(&p, (size_t)sysconf(_SC_PAGESIZE), len);
+  if (rc != 0) {
+    errno = rc;
+    return -1;
+  }
+  b->p = p;
+  return 0;
+}
+
+static void iobuf_free(iobuf_t *b) {
+  if (b->map_len > 0) {
+    munmap(b->p, b->map_len);
+  } else {
+    free(b->p);
+  }
+  b->p = NULL;
+  b->len = 0;
+  b->map_len = 0;
+}
+
+static int stream_copy(int infd, int outfd, flags_t flags) {
+  iobuf_t b;
+  if (iobuf_alloc(&b, iobuf_size(infd, outfd)) < 0) return -1;
+  int rc = stream_copy_buf(infd, outfd, flags, (char *)b.p, b.len);
+  int saved = errno;
+  iobuf_free(&b);
+  errno = saved;
+  return rc;
+}
+
+static ssize_t pread_full(int fd, char *buf, size_t want, off_t off) {
   size_t total = 0;
   while (total < want) {
-    ssize_t n = read(fd, buf + total, want - total);
+    ssize_t n = pread(fd, buf + total, want - total, off + (off_t)total);
     if (n < 0) {
       if (errno == EINTR) continue;
       return -1;
@@ -516,189 +1290,292 @@ static ssize_t read_to_buffer(int fd, char *buf, size_t want) {
   return (ssize_t)total;
 }
 
-static int prepend(char *prefix, int prefix_len, char **str, size_t *str_len, size_t *str_cap) {
-  size_t new_len = *str_len + prefix_len;
-  if (new_len + 1 >= *str_cap) {
-    size_t new_cap = (new_len + 1) * 2;
-    char *new_str = realloc(*str, new_cap);
-    if (new_str == NULL) {
+// Finds the offset where the last `want` lines of [0, end) begin by reading
+// backward in SCAN_BLOCK chunks. Only the offset is kept, never the lines.
+static int last_lines_offset(int fd, off_t end, size_t want, off_t *start) {
+  *start = 0;
+  if (end == 0 || want == 0) {
+    *start = end;
+    return 0;
+  }
+
+  char *buf = malloc(SCAN_BLOCK);
+  if (buf == NULL) return -1;
+
+  size_t seen = 0;
+  off_t pos = end;
+  bool trailing = true;
+  while (pos > 0) {
+    off_t block_start = max(0, pos - SCAN_BLOCK);
+    size_t len = (size_t)(pos - block_start);
+    ssize_t n = pread_full(fd, buf, len, block_start);
+    if (n < 0) {
+      int saved = errno;
+      free(buf);
+      errno = saved;
       return -1;
     }
-    *str = new_str;
-    *str_cap = new_cap;
+    len = (size_t)n;
+
+    // a newline that ends the file terminates the last line, it does not
+    // start a new one
+    if (trailing && len > 0 && block_start + (off_t)len == end && buf[len - 1] == '\n') len--;
+    trailing = false;
+
+    const char *nl;
+    while ((nl = last_newline(buf, len)) != NULL) {
+      len = (size_t)(nl - buf);
+      if (++seen == want) {
+        *start = block_start + (off_t)len + 1;
+        free(buf);
+        return 0;
+      }
+    }
+    pos = block_start;
   }
-  memmove(*str + prefix_len, *str, *str_len);
-  memcpy(*str, prefix, prefix_len);
-  *str_len = new_len;
-  (*str)[new_len] = '\0';
+
+  free(buf);
   return 0;
 }
 
-static int tail_regular_last_bytes(int infd, int outfd, off_t start, size_t want) {
-  if (lseek(infd, start, SEEK_SET) < 0) return -1;
-  char *out = malloc(want);
-  if (out == NULL) {
-    errno = ENOMEM;
-    return -1;
+// Writes [start, end) of fd to outfd without staging it in user space where
+// the kernel allows: copy_file_range into regular files, sendfile into
+// anything else. Whatever the kernel refuses goes through a bounded buffer,
+// so memory never depends on the size of the range.
+static int copy_range(int fd, int outfd, off_t start, off_t end) {
+#ifdef __linux__
+  struct stat out_st;
+  bool file_out = fstat(outfd, &out_st) == 0 && S_ISREG(out_st.st_mode);
+  while (file_out && start < end) {
+    loff_t off = start;
+    size_t chunk = (size_t)min_size((size_t)(end - start), (size_t)1 << 30);
+    ssize_t n = copy_file_range(fd, &off, outfd, NULL, chunk, 0);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EINVAL || errno == ENOSYS || errno == EXDEV || errno == EOPNOTSUPP ||
+          errno == EBADF) {
+        break;
+      }
+      return -1;
+    }
+    if (n == 0) return 0;
+    start = (off_t)off;
   }
-  ssize_t r = read_to_buffer(infd, out, want);
-  if (r < 0) {
+  while (start < end) {
+    size_t chunk = (size_t)min_size((size_t)(end - start), (size_t)1 << 30);
+    ssize_t n = sendfile(outfd, fd, &start, chunk);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP) break;
+      return -1;
+    }
+    if (n == 0) return 0;
+  }
+#endif
+  if (start >= end) return 0;
+
+  char *buf = malloc(SCAN_BLOCK);
+  if (buf == NULL) return -1;
+  while (start < end) {
+    size_t want = min_size((size_t)(end - start), SCAN_BLOCK);
+    ssize_t n = pread_full(fd, buf, want, start);
+    if (n <= 0 || write_bytes(outfd, buf, (size_t)n) < 0) {
+      int saved = errno;
+      free(buf);
+      errno = saved;
+      return n == 0 ? 0 : -1;
+    }
+    start += n;
+  }
+  free(buf);
+  return 0;
+}
+
+// Writes the lines of p[0, len) last to first, batching them into writev.
+static int write_reversed(int outfd, const char *p, size_t len) {
+  struct iovec iov[WRITEV_MAX];
+  int cnt = 0;
+  size_t e = len;
+  while (e > 0) {
+    const char *nl = last_newline(p, e - 1);
+    size_t b = nl != NULL ? (size_t)(nl - p) + 1 : 0;
+    if (filter_line(p + b, e - b)) {
+      iov[cnt].iov_base = (char *)p + b;
+      iov[cnt].iov_len = e - b;
+      if (++cnt == WRITEV_MAX) {
+        if (flush_iov(outfd, iov, cnt) < 0) return -1;
+        cnt = 0;
+      }
+    }
+    e = b;
+  }
+  return flush_iov(outfd, iov, cnt);
+}
+
+// Writes the lines of [start, end) that pass the filter. The range is mapped
+// FILTER_WINDOW at a time, each window cut back to its last newline; a
+// window holding no newline at all is widened until it reaches one.
+static int filter_range(int fd, int outfd, off_t start, off_t end) {
+  off_t page = (off_t)sysconf(_SC_PAGESIZE);
+  off_t window = FILTER_WINDOW;
+  while (start < end) {
+    off_t hi = end - start > window ? start + window : end;
+    off_t map_off = start - start % page;
+    size_t map_len = (size_t)(hi - map_off);
+    char *p = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, map_off);
+    if (p == MAP_FAILED) return -1;
+    posix_madvise(p, map_len, POSIX_MADV_SEQUENTIAL);
+
+    const char *base = p + (start - map_off);
+    size_t len = (size_t)(hi - start);
+    if (hi < end) {
+      const char *nl = last_newline(base, len);
+      if (nl == NULL) {
+        munmap(p, map_len);
+        window *= 2;
+        continue;
+      }
+      len = (size_t)(nl - base) + 1;
+    }
+
+    struct iovec iov[WRITEV_MAX];
+    int cnt = 0;
+    int rc = 0;
+    size_t done = 0;
+    size_t line_len;
+    const char *line;
+    while (rc == 0 && (line = filter_next(base + done, len - done, &line_len)) != NULL) {
+      iov[cnt].iov_base = (char *)line;
+      iov[cnt].iov_len = line_len;
+      if (++cnt == WRITEV_MAX) {
+        rc = flush_iov(outfd, iov, cnt);
+        cnt = 0;
+      }
+      done = (size_t)(line - base) + line_len;
+    }
+    if (rc == 0) rc = flush_iov(outfd, iov, cnt);
     int saved = errno;
-    free(out);
+    munmap(p, map_len);
     errno = saved;
-    return -1;
+    if (rc < 0) return -1;
+    start += (off_t)len;
+    window = FILTER_WINDOW;
   }
-  r = (int)write_bytes(outfd, out, (size_t)r);
-  if (r < 0) {
+  return 0;
+}
+
+// Writes the lines of [start, end) last to first, walking backward through
+// REVERSE_WINDOW sized mappings so only one window is mapped at a time. The
+// first, possibly partial, line of a window is left for the next one; a
+// single line longer than a window is located by a backward scan instead.
+static int reverse_range(int fd, int outfd, off_t start, off_t end) {
+  off_t page = (off_t)sysconf(_SC_PAGESIZE);
+  while (end > start) {
+    off_t lo = max(start, end - REVERSE_WINDOW);
+    off_t map_off = lo - lo % page;
+    size_t map_len = (size_t)(end - map_off);
+    char *p = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, map_off);
+    if (p == MAP_FAILED) return -1;
+    posix_madvise(p, map_len, POSIX_MADV_WILLNEED);
+
+    const char *base = p + (lo - map_off);
+    size_t len = (size_t)(end - lo);
+    size_t keep = 0;
+    if (lo > start) {
+      const char *nl = memchr(base, '\n', len);
+      keep = nl != NULL ? (size_t)(nl - base) + 1 : len;
+    }
+
+    int rc = 0;
+    if (keep < len) rc = write_reversed(outfd, base + keep, len - keep);
     int saved = errno;
-    free(out);
+    munmap(p, map_len);
     errno = saved;
-    return -1;
+    if (rc < 0) return -1;
+
+    if (keep < len) {
+      end = lo + (off_t)keep;
+      continue;
+    }
+    off_t line_start = 0;
+    if (last_lines_offset(fd, end, 1, &line_start) < 0) return -1;
+    line_start = max(line_start, start);
+    int copied = filtering() ? filter_range(fd, outfd, line_start, end)
+                             : copy_range(fd, outfd, line_start, end);
+    if (copied < 0) return -1;
+    end = line_start;
   }
-  free(out);
   return 0;
 }
 
-static int tail_regular_lines(int fd, flags_t flags) {
-  size_t want = flags.count.as.lines;
-
-  line_stack_t s = {0};
-  stack_init(&s);
-  off_t end = lseek(fd, 0, SEEK_END);
-  if (end < 0) {
-    stack_free(&s);
+// tail -r of a pipe: the input is spooled to an unlinked temporary file and
+// reversed from there, so memory stays bounded by the window size.
+static int reverse_spill(int infd, int outfd) {
+  const char *dir = getenv("TMPDIR");
+  if (dir == NULL || *dir == '\0') dir = "/tmp";
+  char path[PATH_MAX];
+  if (snprintf(path, sizeof(path), "%s/tail.XXXXXX", dir) >= (int)sizeof(path)) {
+    errno = ENAMETOOLONG;
     return -1;
   }
-  off_t pos = end;
+  int fd = mkstemp(path);
+  if (fd < 0) return -1;
+  unlink(path);
 
-  size_t carry_cap = BLOCK_SIZE;
-  size_t carry_len = 0;
-  char *carry = malloc(BLOCK_SIZE);
-  if (carry == NULL) {
+  iobuf_t b;
+  if (iobuf_alloc(&b, iobuf_size(infd, fd)) < 0) {
     int saved = errno;
-    stack_free(&s);
+    close(fd);
     errno = saved;
     return -1;
   }
 
-  if (pos > 0) {
-    char last = 0;
-    if (lseek(fd, pos - 1, SEEK_SET) < 0) {
-      int saved = errno;
-      free(carry);
-      stack_free(&s);
-      errno = saved;
-      return -1;
-    }
-    int r = read(fd, &last, 1);
-    if (r < 0) {
-      int saved = errno;
-      free(carry);
-      stack_free(&s);
-      errno = saved;
-      return -1;
-    }
-    if (r == 1 && last == '\n') {
-      carry[0] = '\n';
-      carry_len = 1;
-      pos -= 1;
-    }
-  }
-  size_t have_lines = 0;
-
-  char buf[BLOCK_SIZE];
-  while (pos > 0 && have_lines < want) {
-    off_t block_start = max(0, pos - BLOCK_SIZE);
-    if (lseek(fd, block_start, SEEK_SET) < 0) {
-      int saved = errno;
-      free(carry);
-      stack_free(&s);
-      errno = saved;
-      return -1;
-    }
-    int n = read(fd, buf, pos - block_start);
+  off_t size = 0;
+  int rc = 0;
+  for (;;) {
+    ssize_t n = read(infd, b.p, b.len);
     if (n < 0) {
-      int saved = errno;
-      free(carry);
-      stack_free(&s);
-      errno = saved;
-      return -1;
-    }
-    pos = block_start;
-    int right = n;
-
-    for (int i = n - 1; i >= 0; i--) {
-      if (buf[i] == '\n') {
-        int start = i + 1;
-        int slice_len = right - start;
-        if (prepend(buf + start, slice_len, &carry, &carry_len, &carry_cap) < 0) {
-          int saved = errno;
-          free(carry);
-          stack_free(&s);
-          errno = saved;
-          return -1;
-        }
-        char *line = malloc(carry_len);
-        if (line == NULL) {
-          int saved = errno;
-          free(carry);
-          stack_free(&s);
-          errno = saved;
-          return -1;
-        }
-        memcpy(line, carry, carry_len);
-        if (stack_push(&s, (line_t){.buf = line, .len = carry_len}) < 0) {
-          int saved = errno;
-          free(carry);
-          stack_free(&s);
-          errno = saved;
-          return -1;
-        }
-        carry_len = 0;
-        right = i + 1;
-        have_lines++;
-        if (have_lines == want) break;
-      }
+      if (errno == EINTR) continue;
+      rc = -1;
+      break;
     }
-    if (have_lines < want && right > 0) {
-      if (prepend(buf, right, &carry, &carry_len, &carry_cap) < 0) {
-        int saved = errno;
-        free(carry);
-        stack_free(&s);
-        errno = saved;
-        return -1;
-      }
+    if (n == 0) break;
+    if (write_bytes(fd, (char *)b.p, (size_t)n) < 0) {
+      rc = -1;
+      break;
     }
+    size += n;
   }
+  int saved = errno;
+  iobuf_free(&b);
+  if (rc == 0) {
+    rc = reverse_range(fd, outfd, 0, size);
+    saved = errno;
+  }
+  close(fd);
+  errno = saved;
+  return rc;
+}
 
-  if (have_lines < want && carry_len > 0) {
-    char *line = malloc(carry_len);
-    if (line == NULL) {
-      int saved = errno;
-      free(carry);
-      stack_free(&s);
-      errno = saved;
-      return -1;
-    }
-    memcpy(line, carry, carry_len);
-    if (stack_push(&s, (line_t){.buf = line, .len = carry_len}) < 0) {
-      int saved = errno;
-      free(carry);
-      stack_free(&s);
-      errno = saved;
-      return -1;
-    }
-    have_lines++;
-    carry_len = 0;
+static int tail_stream(int fd, int outfd, flags_t flags) {
+  if (flags.reverse_all) return reverse_spill(fd, outfd);
+  return stream_copy(fd, outfd, flags);
+}
+
+static int tail_regular_lines(int fd, flags_t flags) {
+  off_t end = lseek(fd, 0, SEEK_END);
+  if (end < 0) return -1;
+
+  off_t start = 0;
+  if (!flags.reverse_all && last_lines_offset(fd, end, flags.count.as.lines, &start) < 0) {
+    return -1;
   }
-  flags.reverse = !flags.reverse;
-  int r = write_lines(STDOUT_FILENO, flags, &s);
-  stack_free(&s);
-  free(carry);
-  return r;
+  if (flags.reverse) return reverse_range(fd, STDOUT_FILENO, start, end);
+  if (filtering()) return filter_range(fd, STDOUT_FILENO, start, end);
+  return copy_range(fd, STDOUT_FILENO, start, end);
 }
 
-static int tail_file(char *progname, char *path, flags_t flags) {
+static int tail_file(char *progname, char *path, flags_t flags, follower_t *f) {
   int fd = open(path, O_RDONLY);
   if (fd < 0) return -1;
 
@@ -716,7 +1593,7 @@ static int tail_file(char *progname, char *path, flags_t flags) {
       close(fd);
       exit(2);
     }
-    int rc = stream_copy(fd, STDOUT_FILENO, flags);
+    int rc = tail_stream(fd, STDOUT_FILENO, flags);
     int stream_errno = 0;
     if (rc < 0) stream_errno = errno;
     int close_rc = close(fd);
@@ -745,10 +1622,9 @@ static int tail_file(char *progname, char *path, flags_t flags) {
   }
   case MODE_BYTES: {
     off_t want = (off_t)flags.count.as.bytes;
-    off_t end = lseek(fd, 0, SEEK_END);
+    off_t end = st.st_size;
     if (want > end) want = end;
-    off_t start = end - want;
-    if (tail_regular_last_bytes(fd, STDOUT_FILENO, start, (size_t)want) < 0) {
+    if (copy_range(fd, STDOUT_FILENO, end - want, end) < 0) {
       int saved = errno;
       close(fd);
       errno = saved;
@@ -757,20 +1633,19 @@ static int tail_file(char *progname, char *path, flags_t flags) {
     break;
   }
   case MODE_BLOCKS: {
-    off_t end = lseek(fd, 0, SEEK_END);
+    off_t end = st.st_size;
     size_t blocks_wanted = flags.count.as.blocks;
     if (blocks_wanted > SIZE_MAX / BLOCK_SIZE) {
       errno = EOVERFLOW;
       close(fd);
       return -1;
     }
-    off_t want = blocks_wanted * BLOCK_SIZE;
     off_t start = end;
     if (blocks_wanted > 1) {
       start = end - (blocks_wanted - 1) * (off_t)BLOCK_SIZE;
       if (start < 0) start = 0;
     }
-    if (tail_regular_last_bytes(fd, STDOUT_FILENO, start, (size_t)want) < 0) {
+    if (copy_range(fd, STDOUT_FILENO, start, end) < 0) {
       int saved = errno;
       close(fd);
       errno = saved;
@@ -784,23 +1659,94 @@ static int tail_file(char *progname, char *path, flags_t flags) {
     exit(2);
   }
 
-  if (flags.follow) {
-    if (follow_fd(fd, STDOUT_FILENO) < 0) {
+  if (f != NULL) {
+    if (fstat(fd, &f->st) < 0) {
       int saved = errno;
       close(fd);
       errno = saved;
       return -1;
     }
+    f->fd = fd;
+    f->pos = f->st.st_size;
+    return 0;
   }
-  if (flags.super_follow) {
-    if (follow_name(path, &fd, STDOUT_FILENO) < 0) {
+  close(fd);
+  return 0;
+}
+
+// Sends what a previous run had not yet sent of the file a checkpoint
+// names, if it still exists next to path under another name (rotated), and
+// moves the checkpoint past it so a later run does not send it again.
+static int rotated_remainder(const char *path, checkpoint_t *cp, int outfd) {
+  char dir[PATH_MAX];
+  dir_of(path, dir, sizeof(dir));
+  DIR *d = opendir(dir);
+  if (d == NULL) return 0;
+
+  struct dirent *ent;
+  while ((ent = readdir(d)) != NULL) {
+    if (ent->d_ino != cp->ino) continue;
+    int fd = openat(dirfd(d), ent->d_name, O_RDONLY);
+    if (fd < 0) continue;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_dev != cp->dev || st.st_ino != cp->ino) {
+      close(fd);
+      continue;
+    }
+    int rc = 0;
+    if (cp->offset < st.st_size) rc = copy_range(fd, outfd, cp->offset, st.st_size);
+    if (rc == 0 && cp->offset < st.st_size) cp->offset = st.st_size;
+    int saved = errno;
+    close(fd);
+    closedir(d);
+    errno = saved;
+    return rc;
+  }
+  closedir(d);
+  return 0;
+}
+
+// Picks up a followed path where a previous run's checkpoint left it. If
+// the path was rotated in between, the rest of the old file goes out first
+// and the new one is followed from its beginning. Returns 1 when there is
+// nothing to resume and the file should be tailed normally.
+static int follow_resume(const char *path, checkpoint_t *cp, follower_t *f, bool by_name) {
+  int fd = open(path, O_RDONLY);
+  int open_errno = errno;
+  struct stat st;
+  if (fd >= 0) {
+    if (fstat(fd, &st) < 0) {
       int saved = errno;
       close(fd);
       errno = saved;
       return -1;
     }
+    if (!S_ISREG(st.st_mode)) {
+      close(fd);
+      return 1;
+    }
+    if (st.st_dev == cp->dev && st.st_ino == cp->ino) {
+      f->fd = fd;
+      f->st = st;
+      f->pos = cp->offset <= st.st_size ? cp->offset : 0;
+      return 0;
+    }
   }
-  close(fd);
+
+  if (rotated_remainder(path, cp, STDOUT_FILENO) < 0) {
+    int saved = errno;
+    if (fd >= 0) close(fd);
+    errno = saved;
+    return -1;
+  }
+  if (fd < 0) {
+    if (by_name) return 0;
+    errno = open_errno;
+    return -1;
+  }
+  f->fd = fd;
+  f->st = st;
+  f->pos = 0;
   return 0;
 }
 
@@ -812,8 +1758,10 @@ int main(int argc, char *argv[]) {
       .mode = MODE_LINES,
       .as = {.lines = 10},
   };
+  flags.interval = 1.0;
+  bool count_given = false;
 
-  while ((ch = getopt(argc, argv, "fFrqvb:c:n:")) != -1) {
+  while ((ch = getopt(argc, argv, "fFrqvb:c:e:n:s:L:P:")) != -1) {
     switch (ch) {
     case 'f':
       flags.follow = true;
@@ -830,12 +1778,43 @@ int main(int argc, char *argv[]) {
     case 'v':
       flags.verbose = true;
       break;
+    case 's': {
+      char *end = NULL;
+      errno = 0;
+      double interval = strtod(optarg, &end);
+      if (end == optarg || *end != '\0' || errno == ERANGE || interval <= 0 || interval > 86400) {
+        fprintf(stderr, "%s: invalid sleep interval -- %s\n", argv[0], optarg);
+        exit(2);
+      }
+      flags.interval = interval;
+      break;
+    }
+    case 'L': {
+      char *end = NULL;
+      errno = 0;
+      double latency = strtod(optarg, &end);
+      if (end == optarg || *end != '\0' || errno == ERANGE || latency < 0 ||
+          latency > 86400000) {
+        fprintf(stderr, "%s: invalid latency -- %s\n", argv[0], optarg);
+        exit(2);
+      }
+      flags.lines_only = true;
+      flags.latency = latency / 1000;
+      break;
+    }
+    case 'P':
+      flags.state_path = optarg;
+      break;
+    case 'e':
+      if (filter_add(optarg) < 0) error_errno(argv[0], errno, "malloc");
+      break;
     case 'n': {
       size_t lines = 0;
       count_e r = parse_count(optarg, &lines);
       if (r != COUNT_OK) parse_err(r, argv[0], optarg);
       flags.count.mode = MODE_LINES;
       flags.count.as.lines = lines;
+      count_given = true;
       break;
     }
     case 'c': {
@@ -863,9 +1842,16 @@ int main(int argc, char *argv[]) {
     fprintf(stderr, "%s: cannot use -r with bytes or blocks mode\n", argv[0]);
     exit(2);
   }
+  if (flags.count.mode != MODE_LINES && filtering()) {
+    fprintf(stderr, "%s: cannot use -e with bytes or blocks mode\n", argv[0]);
+    exit(2);
+  }
+  if (filtering()) filter_kernel_init();
+  // BSD tail -r without a count reverses the whole input
+  flags.reverse_all = flags.reverse && !count_given;
 
-  if ((flags.follow || flags.super_follow) && (argc - optind != 1)) {
-    fprintf(stderr, "%s: -f and -F currently support exactly one file\n", argv[0]);
+  if (flags.state_path != NULL && !flags.follow && !flags.super_follow) {
+    fprintf(stderr, "%s: -P requires -f or -F\n", argv[0]);
     exit(2);
   }
 
@@ -875,7 +1861,7 @@ int main(int argc, char *argv[]) {
       exit(2);
     }
 
-    if (stream_copy(STDIN_FILENO, STDOUT_FILENO, flags) < 0) {
+    if (tail_stream(STDIN_FILENO, STDOUT_FILENO, flags) < 0) {
       error_errno(argv[0], errno, "stdin");
       return 1;
     }
@@ -890,14 +1876,47 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  size_t nfiles = (size_t)(argc - optind);
+  follower_t *followers = NULL;
+  if (flags.follow || flags.super_follow) {
+    followers = calloc(nfiles, sizeof(*followers));
+    if (followers == NULL) error_errno(argv[0], errno, "calloc");
+  }
+
+  state_t state = {0};
+  if (flags.state_path != NULL) {
+    size_t len = strlen(flags.state_path) + sizeof(".tmp");
+    state.path = flags.state_path;
+    state.tmp_path = malloc(len);
+    if (state.tmp_path == NULL) error_errno(argv[0], errno, "malloc");
+    snprintf(state.tmp_path, len, "%s.tmp", flags.state_path);
+    if (state_load(&state) < 0) error_errno(argv[0], errno, state.path);
+    catch_stop_signals();
+  }
+
   int exit_code = 0;
-  for (int i = optind; i < argc; i++) {
-    char *filename = argv[i];
-    if (!flags.quiet) fprintf(stdout, "==> %s <==\n", filename);
-    if (tail_file(argv[0], filename, flags) < 0) {
+  for (size_t i = 0; i < nfiles; i++) {
+    char *filename = argv[optind + (int)i];
+    follower_t *f = NULL;
+    if (followers != NULL) {
+      f = &followers[i];
+      f->path = filename;
+      f->fd = -1;
+    }
+    if (!flags.quiet) print_header(filename, i == 0);
+
+    checkpoint_t *cp = state.path != NULL ? state_find(&state, filename) : NULL;
+    int rc = cp != NULL ? follow_resume(filename, cp, f, flags.super_follow) : 1;
+    if (rc > 0) rc = tail_file(argv[0], filename, flags, f);
+    if (rc < 0) {
       error_errno(argv[0], errno, filename);
       exit_code = 1;
     }
   }
+
+  if (followers != NULL) {
+    follow_files(argv[0], followers, nfiles, flags, nfiles - 1,
+                 state.path != NULL ? &state : NULL);
+  }
   return exit_code;
 }
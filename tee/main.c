@@ -1,26 +1,66 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
+#include <spawn.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/signal.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
+#ifdef __linux__
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+#endif
+#endif
+
+#define IOBUF_DEFAULT (64 * 1024)
+#define IOBUF_AUTO_MAX (1024 * 1024)
+#define IOBUF_HUGE (2 * 1024 * 1024)
+#define IOBUF_MAX (256 * 1024 * 1024)
+#define ASYNC_DEPTH_DEFAULT 16
+#define ROTATE_KEEP_DEFAULT 5
+#define URING_MAX_OUTPUTS 1024
+#define URING_READ_TAG UINT64_MAX
+
+typedef enum {
+  FULL_BLOCK,
+  FULL_DROP,
+  FULL_DETACH,
+} full_policy_e;
 
-static void ignore_sigint(void) {
+static void ignore_signal(int sig) {
   struct sigaction sa;
   memset(&sa, 0, sizeof(sa));
   sa.sa_handler = SIG_IGN;
   sigemptyset(&sa.sa_mask);
   sa.sa_flags = 0;
-  sigaction(SIGINT, &sa, NULL);
+  sigaction(sig, &sa, NULL);
 }
 
 static void usage(const char *progname) {
-  dprintf(STDERR_FILENO, "Usage: %s [-ai] [file...]\n", progname);
+  dprintf(STDERR_FILENO,
+          "Usage: %s [-aiz] [-Q depth] [-P block|drop|detach] [-C size] [-T seconds]\n"
+          "       [-K generations] [file...]\n",
+          progname);
   exit(2);
 }
 
@@ -48,27 +88,1174 @@ static int write_all(int fd, const void *buf, size_t len) {
   return 0;
 }
 
-static int stream_copy(int infd, int *outfds, size_t outfd_count) {
-  uint8_t buf[64 * 1024];
+typedef struct rotator rotator_t;
+
+// One tee output. A failed write takes it out of the fan-out instead of
+// ending tee; what went wrong and how much it got is reported at exit.
+// With rotation, gen_bytes and gen_started describe the current file.
+typedef struct {
+  int fd;
+  const char *name;
+  bool dead;
+  int err;
+  uint64_t written;
+  rotator_t *rot;
+  uint64_t gen_bytes;
+  double gen_started;
+} output_t;
+
+static void output_fail(output_t *o, int err) {
+  o->dead = true;
+  o->err = err;
+}
+
+static bool outputs_live(const output_t *outs, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    if (!outs[i].dead) return true;
+  }
+  return false;
+}
+
+typedef struct rotate_job {
+  struct rotate_job *next;
+  char *tmp;
+  const char *name;
+} rotate_job_t;
+
+// Output rotation. The write loop only closes the full file, renames it
+// aside and opens a fresh one; shifting the older generations, dropping
+// the oldest and compressing happen in order on a background thread.
+struct rotator {
+  const char *progname;
+  uint64_t max_bytes;
+  double interval;
+  unsigned keep;
+  bool compress;
+  int open_flags;
+  uint64_t seq;
+
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  rotate_job_t *head;
+  rotate_job_t *tail;
+  bool closing;
+};
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void rotate_warn(const rotator_t *rot, const char *path) {
+  dprintf(STDERR_FILENO, "%s: %s: %s\n", rot->progname, path, strerror(errno));
+}
+
+// Runs gzip on path, which replaces it with path.gz.
+static void rotate_compress(const rotator_t *rot, char *path) {
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+  char *argv[] = {"gzip", "-f", "--", path, NULL};
+  pid_t pid;
+  int err = posix_spawnp(&pid, "gzip", &actions, NULL, argv, NULL);
+  posix_spawn_file_actions_destroy(&actions);
+  if (err != 0) {
+    errno = err;
+    rotate_warn(rot, "gzip");
+    return;
+  }
+  int status;
+  while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+  }
+}
+
+// name.K is dropped, name.1 .. name.K-1 move up by one and the file just
+// rotated out becomes name.1. Compressed generations carry a .gz suffix.
+static void rotate_shift(const rotator_t *rot, const rotate_job_t *job) {
+  static const char *const suffixes[] = {"", ".gz"};
+  char from[PATH_MAX];
+  char to[PATH_MAX];
+  if (rot->keep == 0) {
+    unlink(job->tmp);
+    return;
+  }
+  for (size_t k = 0; k < 2; k++) {
+    snprintf(to, sizeof(to), "%s.%u%s", job->name, rot->keep, suffixes[k]);
+    if (unlink(to) < 0 && errno != ENOENT) rotate_warn(rot, to);
+  }
+  for (unsigned gen = rot->keep - 1; gen >= 1; gen--) {
+    for (size_t k = 0; k < 2; k++) {
+      snprintf(from, sizeof(from), "%s.%u%s", job->name, gen, suffixes[k]);
+      snprintf(to, sizeof(to), "%s.%u%s", job->name, gen + 1, suffixes[k]);
+      if (rename(from, to) < 0 && errno != ENOENT) rotate_warn(rot, from);
+    }
+  }
+  snprintf(to, sizeof(to), "%s.1", job->name);
+  if (rename(job->tmp, to) < 0) {
+    rotate_warn(rot, job->tmp);
+    return;
+  }
+  if (rot->compress) rotate_compress(rot, to);
+}
+
+static void *rotator_main(void *arg) {
+  rotator_t *rot = arg;
+  pthread_mutex_lock(&rot->lock);
   for (;;) {
-    ssize_t n = read(infd, buf, sizeof(buf));
+    while (rot->head == NULL && !rot->closing) pthread_cond_wait(&rot->ready, &rot->lock);
+    rotate_job_t *job = rot->head;
+    if (job == NULL) break;
+    rot->head = job->next;
+    if (rot->head == NULL) rot->tail = NULL;
+    pthread_mutex_unlock(&rot->lock);
+
+    rotate_shift(rot, job);
+    free(job->tmp);
+    free(job);
+
+    pthread_mutex_lock(&rot->lock);
+  }
+  pthread_mutex_unlock(&rot->lock);
+  return NULL;
+}
+
+static int rotator_start(rotator_t *rot) {
+  pthread_mutex_init(&rot->lock, NULL);
+  pthread_cond_init(&rot->ready, NULL);
+  int err = pthread_create(&rot->thread, NULL, rotator_main, rot);
+  if (err != 0) {
+    errno = err;
+    return -1;
+  }
+  return 0;
+}
+
+// Lets the queued jobs finish before tee exits.
+static void rotator_stop(rotator_t *rot) {
+  pthread_mutex_lock(&rot->lock);
+  rot->closing = true;
+  pthread_cond_signal(&rot->ready);
+  pthread_mutex_unlock(&rot->lock);
+  pthread_join(rot->thread, NULL);
+  pthread_cond_destroy(&rot->ready);
+  pthread_mutex_destroy(&rot->lock);
+}
+
+// Closes o's file, renames it aside and opens a fresh one under the same
+// name; the older generations are shifted on the rotator thread. On
+// failure the output is left closed and errno is set.
+static int output_rotate(output_t *o) {
+  rotator_t *rot = o->rot;
+  rotate_job_t *job = malloc(sizeof(*job));
+  size_t tmp_len = strlen(o->name) + 32;
+  char *tmp = malloc(tmp_len);
+  if (job == NULL || tmp == NULL) {
+    free(job);
+    free(tmp);
+    errno = ENOMEM;
+    return -1;
+  }
+  snprintf(tmp, tmp_len, "%s.rotating.%ju", o->name, (uintmax_t)rot->seq++);
+
+  int fd = -1;
+  if (close(o->fd) < 0 || rename(o->name, tmp) < 0 ||
+      (fd = open(o->name, rot->open_flags | O_TRUNC, 0666)) < 0) {
+    int saved = errno;
+    free(job);
+    free(tmp);
+    o->fd = -1;
+    errno = saved;
+    return -1;
+  }
+  o->fd = fd;
+  o->gen_bytes = 0;
+  o->gen_started = now_seconds();
+
+  *job = (rotate_job_t){.tmp = tmp, .name = o->name};
+  pthread_mutex_lock(&rot->lock);
+  if (rot->tail != NULL) {
+    rot->tail->next = job;
+  } else {
+    rot->head = job;
+  }
+  rot->tail = job;
+  pthread_cond_signal(&rot->ready);
+  pthread_mutex_unlock(&rot->lock);
+  return 0;
+}
+
+// Whether o's interval has run out with data in the file. An empty file
+// is not rotated out; its interval starts over instead.
+static bool output_expired(output_t *o, double now) {
+  if (o->rot->interval <= 0 || now - o->gen_started < o->rot->interval) return false;
+  if (o->gen_bytes > 0) return true;
+  o->gen_started = now;
+  return false;
+}
+
+static bool outputs_rotate(const output_t *outs, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    if (outs[i].rot != NULL) return true;
+  }
+  return false;
+}
+
+typedef struct {
+  uint8_t *p;
+  size_t len;
+  size_t map_len;
+} iobuf_t;
+
+static size_t iobuf_env_size(void) {
+  const char *s = getenv("CORE_UTILS_BUFSIZE");
+  // strtoull would take "-1" and wrap it; only plain digits are a size
+  if (s == NULL || *s < '0' || *s > '9') return 0;
+
+  // out-of-range values saturate at ULLONG_MAX and are clamped below
+  char *end = NULL;
+  unsigned long long val = strtoull(s, &end, 10);
+  if (end == s) return 0;
+  unsigned shift = 0;
+  if (*end == 'k' || *end == 'K') {
+    shift = 10;
+    end++;
+  } else if (*end == 'm' || *end == 'M') {
+    shift = 20;
+    end++;
+  }
+  if (*end != '\0') return 0;
+  if (val > ((unsigned long long)IOBUF_MAX >> shift)) return IOBUF_MAX;
+  return (size_t)val << shift;
+}
+
+// Sized for stdin and stdout. The pipes are resized only when the user
+// asked for a specific size through CORE_UTILS_BUFSIZE.
+static size_t iobuf_size(int infd, int outfd) {
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t want = iobuf_env_size();
+  bool explicit_size = want != 0;
+  int fds[2] = {infd, outfd};
+
+  if (!explicit_size) {
+    want = IOBUF_DEFAULT;
+    for (size_t i = 0; i < 2; i++) {
+      struct stat st;
+      if (fstat(fds[i], &st) < 0) continue;
+      if (st.st_blksize > 0 && (size_t)st.st_blksize > want) want = (size_t)st.st_blksize;
+#ifdef F_GETPIPE_SZ
+      if (S_ISFIFO(st.st_mode)) {
+        int cap = fcntl(fds[i], F_GETPIPE_SZ);
+        if (cap > 0 && (size_t)cap > want) want = (size_t)cap;
+      }
+#endif
+    }
+    if (want > IOBUF_AUTO_MAX) want = IOBUF_AUTO_MAX;
+  }
+
+  if (want < page) want = page;
+  want = (want + page - 1) / page * page;
+
+#ifdef F_SETPIPE_SZ
+  if (explicit_size) {
+    for (size_t i = 0; i < 2; i++) {
+      struct stat st;
+      if (fstat(fds[i], &st) < 0 || !S_ISFIFO(st.st_mode)) continue;
+      int cap = fcntl(fds[i], F_GETPIPE_SZ);
+      if (cap > 0 && (size_t)cap < want) fcntl(fds[i], F_SETPIPE_SZ, (int)want);
+    }
+  }
+#endif
+  return want;
+}
+
+static int iobuf_alloc(iobuf_t *b, size_t len) {
+  b->len = len;
+  b->map_len = 0;
+#ifdef MAP_ANONYMOUS
+  if (len >= IOBUF_HUGE) {
+    size_t map_len = (len + IOBUF_HUGE - 1) / IOBUF_HUGE * IOBUF_HUGE;
+    uint8_t *raw = mmap(NULL, map_len + IOBUF_HUGE, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw != MAP_FAILED) {
+      size_t lead = (IOBUF_HUGE - (uintptr_t)raw % IOBUF_HUGE) % IOBUF_HUGE;
+      if (lead > 0) munmap(raw, lead);
+      munmap(raw + lead + map_len, IOBUF_HUGE - lead);
+      b->p = raw + lead;
+      b->map_len = map_len;
+#ifdef MADV_HUGEPAGE
+      madvise(b->p, b->map_len, MADV_HUGEPAGE);
+#endif
+      return 0;
+    }
+  }
+#endif
+  void *p = NULL;
+  int rc = posix_memalign(&p, (size_t)sysconf(_SC_PAGESIZE), len);
+  if (rc != 0) {
+    errno = rc;
+    return -1;
+  }
+  b->p = p;
+  return 0;
+}
+
+static void iobuf_free(iobuf_t *b) {
+  if (b->map_len > 0) {
+    munmap(b->p, b->map_len);
+  } else {
+    free(b->p);
+  }
+  b->p = NULL;
+  b->len = 0;
+  b->map_len = 0;
+}
+
+#ifdef __linux__
+// One output of the kernel fan-out. Every output except the last gets a
+// scratch pipe that tee(2) duplicates stdin into; the last one consumes
+// stdin itself. An output that refuses splice is switched to copy mode and
+// fed from its pipe through the buffer instead. teed is how much of the
+// current chunk tee(2) put in the scratch pipe.
+typedef struct {
+  output_t *out;
+  int pipe[2];
+  bool copy;
+  size_t teed;
+} fan_t;
+
+// Moves len bytes already waiting in the pipe infd to o's output. If the
+// output fails it is marked dead and the rest is read and dropped, so the
+// pipe ends up drained either way; only a failed read is an error.
+static int fan_drain(int infd, fan_t *o, size_t len, iobuf_t *b) {
+  while (len > 0 && !o->copy && !o->out->dead) {
+    ssize_t n = splice(infd, NULL, o->out->fd, NULL, len, SPLICE_F_MOVE);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EINVAL) {
+        o->copy = true;
+      } else {
+        output_fail(o->out, errno);
+      }
+      break;
+    }
+    if (n == 0) {
+      output_fail(o->out, EIO);
+      break;
+    }
+    len -= (size_t)n;
+    o->out->written += (uint64_t)n;
+  }
+  while (len > 0) {
+    ssize_t n = read(infd, b->p, len < b->len ? len : b->len);
     if (n < 0) {
       if (errno == EINTR) continue;
       return -1;
     }
-    if (n == 0) return 0;
+    if (n == 0) {
+      errno = EIO;
+      return -1;
+    }
+    if (!o->out->dead) {
+      if (write_all(o->out->fd, b->p, (size_t)n) < 0) {
+        output_fail(o->out, errno);
+      } else {
+        o->out->written += (uint64_t)n;
+      }
+    }
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+// Consumes len bytes of stdin through the buffer after a short tee(2):
+// the last output gets all of them and every scratch output whatever its
+// pipe did not take.
+static int fan_spread(int infd, fan_t *fans, size_t from, size_t count, size_t len, iobuf_t *b) {
+  size_t off = 0;
+  while (off < len) {
+    ssize_t n = read(infd, b->p, len - off < b->len ? len - off : b->len);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    if (n == 0) {
+      errno = EIO;
+      return -1;
+    }
+    for (size_t i = from; i < count; i++) {
+      fan_t *f = &fans[i];
+      size_t skip = i + 1 < count ? f->teed : 0;
+      if (f->out->dead || off + (size_t)n <= skip) continue;
+      size_t at = skip > off ? skip - off : 0;
+      if (write_all(f->out->fd, b->p + at, (size_t)n - at) < 0) {
+        output_fail(f->out, errno);
+      } else {
+        f->out->written += (uint64_t)n - at;
+      }
+    }
+    off += (size_t)n;
+  }
+  return 0;
+}
+
+static void fan_free(fan_t *fans, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    if (fans[i].pipe[0] >= 0) close(fans[i].pipe[0]);
+    if (fans[i].pipe[1] >= 0) close(fans[i].pipe[1]);
+  }
+  free(fans);
+}
+
+// Fans a piped stdin out without copying it through user space: each
+// chunk is tee(2)'d into the scratch pipes of the live outputs, spliced
+// from them into those outputs, and finally spliced out of stdin into the
+// last output. Returns 1 when stdin is not a pipe or the kernel refuses,
+// so the caller continues with the read/write loop; nothing is left in
+// flight between chunks, so that can happen at any chunk boundary.
+static int fanout_copy(int infd, output_t *outs, size_t outfd_count, iobuf_t *b) {
+  struct stat st;
+  if (fstat(infd, &st) < 0 || !S_ISFIFO(st.st_mode)) return 1;
+  int in_cap = fcntl(infd, F_GETPIPE_SZ);
+  if (in_cap <= 0) return 1;
+
+  fan_t *fans = calloc(outfd_count, sizeof(*fans));
+  if (fans == NULL) return -1;
+  for (size_t i = 0; i < outfd_count; i++) {
+    fans[i].out = &outs[i];
+    fans[i].pipe[0] = fans[i].pipe[1] = -1;
+  }
+
+  // a chunk should fit every scratch pipe whole; tee(2) counts pipe
+  // buffers rather than bytes though, so a smaller pipe can still come up
+  // short and then gets the rest through fan_spread
+  size_t chunk = (size_t)in_cap;
+  for (size_t i = 0; i + 1 < outfd_count; i++) {
+    if (pipe2(fans[i].pipe, O_CLOEXEC) < 0) {
+      fan_free(fans, outfd_count);
+      return 1;
+    }
+    int cap = fcntl(fans[i].pipe[1], F_SETPIPE_SZ, in_cap);
+    if (cap < 0) cap = fcntl(fans[i].pipe[1], F_GETPIPE_SZ);
+    if (cap <= 0) {
+      fan_free(fans, outfd_count);
+      return 1;
+    }
+    if ((size_t)cap < chunk) chunk = (size_t)cap;
+  }
+
+  fan_t *last = &fans[outfd_count - 1];
+  bool started = false;
+  int rc = 0;
+  while (rc == 0) {
+    size_t lead = 0;
+    while (lead + 1 < outfd_count && fans[lead].out->dead) lead++;
+
+    if (lead + 1 == outfd_count) {
+      // only the last output is left: splice stdin straight into it
+      if (last->out->dead || last->copy) {
+        rc = 1;
+        break;
+      }
+      ssize_t n = splice(infd, NULL, last->out->fd, NULL, chunk, SPLICE_F_MOVE);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        if (errno == EINVAL || errno == ENOSYS) {
+          rc = 1;
+        } else {
+          output_fail(last->out, errno);
+        }
+        continue;
+      }
+      if (n == 0) break;
+      last->out->written += (uint64_t)n;
+      continue;
+    }
+
+    ssize_t n = tee(infd, fans[lead].pipe[1], chunk, 0);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (!started && (errno == EINVAL || errno == ENOSYS)) {
+        rc = 1;
+      } else {
+        rc = -1;
+      }
+      break;
+    }
+    if (n == 0) break;
+    started = true;
+
+    bool short_tee = false;
+    for (size_t i = lead; i + 1 < outfd_count; i++) {
+      fans[i].teed = 0;
+      if (fans[i].out->dead) continue;
+      if (i == lead) {
+        fans[i].teed = (size_t)n;
+        continue;
+      }
+      ssize_t t;
+      do {
+        t = tee(infd, fans[i].pipe[1], (size_t)n, 0);
+      } while (t < 0 && errno == EINTR);
+      fans[i].teed = t > 0 ? (size_t)t : 0;
+      if (fans[i].teed < (size_t)n) short_tee = true;
+    }
+    for (size_t i = lead; i + 1 < outfd_count && rc == 0; i++) {
+      if (fans[i].teed > 0 && fan_drain(fans[i].pipe[0], &fans[i], fans[i].teed, b) < 0) {
+        rc = -1;
+      }
+    }
+    if (rc == 0 && short_tee) {
+      if (fan_spread(infd, fans, lead, outfd_count, (size_t)n, b) < 0) rc = -1;
+    } else if (rc == 0 && fan_drain(infd, last, (size_t)n, b) < 0) {
+      rc = -1;
+    }
+  }
+
+  int saved = errno;
+  fan_free(fans, outfd_count);
+  errno = saved;
+  return rc;
+}
+#endif
+
+#ifdef HAVE_IO_URING
+typedef struct {
+  int fd;
+  unsigned entries;
+  unsigned to_submit;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *sq_ring;
+  void *cq_ring;
+  size_t sq_ring_len;
+  size_t cq_ring_len;
+  size_t sqes_len;
+} uring_t;
+
+static void uring_free(uring_t *r) {
+  if (r->sqes != NULL && r->sqes != MAP_FAILED) munmap(r->sqes, r->sqes_len);
+  if (r->cq_ring != NULL && r->cq_ring != MAP_FAILED && r->cq_ring != r->sq_ring) {
+    munmap(r->cq_ring, r->cq_ring_len);
+  }
+  if (r->sq_ring != NULL && r->sq_ring != MAP_FAILED) munmap(r->sq_ring, r->sq_ring_len);
+  close(r->fd);
+}
+
+static int uring_init(uring_t *r, unsigned entries) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  memset(r, 0, sizeof(*r));
+
+  int fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+  if (fd < 0) return -1;
+
+  r->fd = fd;
+  r->entries = params.sq_entries;
+  r->sq_ring_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  r->cq_ring_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single) {
+    if (r->cq_ring_len > r->sq_ring_len) r->sq_ring_len = r->cq_ring_len;
+    r->cq_ring_len = r->sq_ring_len;
+  }
+  r->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+
+  r->sq_ring = mmap(0, r->sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                    IORING_OFF_SQ_RING);
+  if (r->sq_ring != MAP_FAILED) {
+    r->cq_ring = single ? r->sq_ring
+                        : mmap(0, r->cq_ring_len, PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+  }
+  if (r->cq_ring != NULL && r->cq_ring != MAP_FAILED) {
+    r->sqes = mmap(0, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                   IORING_OFF_SQES);
+  }
+  if (r->sqes == NULL || r->sqes == MAP_FAILED) {
+    int saved = errno;
+    uring_free(r);
+    errno = saved;
+    return -1;
+  }
+
+  uint8_t *sq = r->sq_ring;
+  uint8_t *cq = r->cq_ring;
+  r->sq_head = (unsigned *)(sq + params.sq_off.head);
+  r->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+  r->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+  r->sq_array = (unsigned *)(sq + params.sq_off.array);
+  r->cq_head = (unsigned *)(cq + params.cq_off.head);
+  r->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+  r->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+  r->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+  return 0;
+}
+
+static int uring_enter(uring_t *r, unsigned wait) {
+  for (;;) {
+    unsigned flags = wait > 0 ? IORING_ENTER_GETEVENTS : 0;
+    long n = syscall(__NR_io_uring_enter, r->fd, r->to_submit, wait, flags, NULL, 0);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    r->to_submit -= (unsigned)n;
+    return 0;
+  }
+}
+
+// At most one write per output and one read of stdin are in flight at a
+// time, and the ring has outfd_count + 1 entries, so a free SQE is always
+// available here.
+static struct io_uring_sqe *uring_sqe(uring_t *r, uint64_t user_data) {
+  unsigned tail = *r->sq_tail;
+  unsigned idx = tail & *r->sq_mask;
+  struct io_uring_sqe *sqe = &r->sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->user_data = user_data;
+  r->sq_array[idx] = idx;
+  __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  r->to_submit++;
+  return sqe;
+}
+
+static void uring_prep(struct io_uring_sqe *sqe, int fd, uint8_t *buf, size_t len, int buf_index,
+                       bool is_read) {
+  if (buf_index >= 0) {
+    sqe->opcode = is_read ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+    sqe->buf_index = (uint16_t)buf_index;
+  } else {
+    sqe->opcode = is_read ? IORING_OP_READ : IORING_OP_WRITE;
+  }
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)(uintptr_t)buf;
+  sqe->len = (uint32_t)len;
+  // -1: use and advance the file position, as read(2)/write(2) would
+  sqe->off = (uint64_t)-1;
+}
+
+// Per-output progress through the chunk being written.
+typedef struct {
+  size_t done;
+  bool busy;
+} uring_write_t;
+
+// Batched fan-out through io_uring with two buffers: while every output's
+// write of one chunk is in flight, the read of the next chunk is too, and
+// all of them go to the kernel in one io_uring_enter. Each chunk's writes
+// complete before the next chunk's are queued, which keeps every output in
+// order; short writes are resubmitted for the remainder. The buffers are
+// registered with the ring when the kernel lets us, so the fixed-buffer
+// opcodes skip pinning user memory for every request. Returns 1 if the
+// ring cannot be set up or the kernel rejects the first read, so the
+// caller can use the read/write loop.
+static int uring_copy(int infd, output_t *outs, size_t outfd_count, iobuf_t *bufs) {
+  if (outfd_count > URING_MAX_OUTPUTS) return 1;
+  uring_t r;
+  if (uring_init(&r, (unsigned)outfd_count + 1) < 0) return 1;
+  uring_write_t *writes = calloc(outfd_count, sizeof(*writes));
+  if (writes == NULL) {
+    uring_free(&r);
+    return -1;
+  }
+
+  struct iovec iov[2] = {{bufs[0].p, bufs[0].len}, {bufs[1].p, bufs[1].len}};
+  bool fixed = syscall(__NR_io_uring_register, r.fd, IORING_REGISTER_BUFFERS, iov, 2) == 0;
+
+  int rc = 0;
+  size_t cur = 0;
+  size_t len = 0;
+  bool started = false;
+  bool reading = true;
+  uring_prep(uring_sqe(&r, URING_READ_TAG), infd, bufs[0].p, bufs[0].len, fixed ? 0 : -1, true);
+
+  for (;;) {
+    // reap until the read and every write of the current chunk are done
+    size_t busy = 0;
+    for (size_t i = 0; i < outfd_count; i++) busy += writes[i].busy;
+    ssize_t got = -1;
+    while (rc == 0 && (reading || busy > 0)) {
+      if (uring_enter(&r, 1) < 0) {
+        rc = -1;
+        break;
+      }
+      unsigned head = *r.cq_head;
+      unsigned tail = __atomic_load_n(r.cq_tail, __ATOMIC_ACQUIRE);
+      for (; head != tail; head++) {
+        struct io_uring_cqe *cqe = &r.cqes[head & *r.cq_mask];
+        int res = cqe->res;
+        if (cqe->user_data == URING_READ_TAG) {
+          size_t next = started ? cur ^ 1 : cur;
+          if (res == -EINTR || res == -EAGAIN) {
+            uring_prep(uring_sqe(&r, URING_READ_TAG), infd, bufs[next].p, bufs[next].len,
+                       fixed ? (int)next : -1, true);
+          } else if (res < 0) {
+            errno = -res;
+            rc = !started && (errno == EINVAL || errno == EOPNOTSUPP) ? 1 : -1;
+            reading = false;
+          } else {
+            got = res;
+            reading = false;
+          }
+          continue;
+        }
+
+        size_t i = (size_t)cqe->user_data;
+        output_t *o = &outs[i];
+        if (res == -EINTR || res == -EAGAIN) {
+          res = 0;
+        } else if (res < 0 || (res == 0 && writes[i].done < len)) {
+          output_fail(o, res < 0 ? -res : EIO);
+          writes[i].busy = false;
+          busy--;
+          continue;
+        }
+        writes[i].done += (size_t)res;
+        o->written += (uint64_t)res;
+        if (writes[i].done < len) {
+          uring_prep(uring_sqe(&r, (uint64_t)i), o->fd, bufs[cur].p + writes[i].done,
+                     len - writes[i].done, fixed ? (int)cur : -1, false);
+        } else {
+          writes[i].busy = false;
+          busy--;
+        }
+      }
+      __atomic_store_n(r.cq_head, head, __ATOMIC_RELEASE);
+    }
+    if (rc != 0 || got <= 0) break;
+
+    // the chunk that just arrived goes out to every live output while the
+    // read of the one after it is already queued
+    if (started) cur ^= 1;
+    started = true;
+    len = (size_t)got;
+    if (!outputs_live(outs, outfd_count)) break;
     for (size_t i = 0; i < outfd_count; i++) {
-      if (write_all(outfds[i], buf, (size_t)n) < 0) return -1;
+      writes[i].done = 0;
+      writes[i].busy = !outs[i].dead;
+      if (writes[i].busy) {
+        uring_prep(uring_sqe(&r, (uint64_t)i), outs[i].fd, bufs[cur].p, len,
+                   fixed ? (int)cur : -1, false);
+      }
+    }
+    reading = true;
+    uring_prep(uring_sqe(&r, URING_READ_TAG), infd, bufs[cur ^ 1].p, bufs[cur ^ 1].len,
+               fixed ? (int)(cur ^ 1) : -1, true);
+  }
+
+  int saved = errno;
+  free(writes);
+  uring_free(&r);
+  errno = saved;
+  return rc;
+}
+#endif
+
+// A chunk of stdin shared by every async writer; the last one to finish
+// with it hands it back to the pool.
+typedef struct chunk {
+  struct chunk *next;
+  size_t len;
+  int refs;
+  uint8_t data[];
+} chunk_t;
+
+typedef struct {
+  pthread_mutex_t lock;
+  chunk_t *free;
+  size_t size;
+} chunk_pool_t;
+
+static chunk_t *chunk_get(chunk_pool_t *pool) {
+  pthread_mutex_lock(&pool->lock);
+  chunk_t *c = pool->free;
+  if (c != NULL) pool->free = c->next;
+  pthread_mutex_unlock(&pool->lock);
+  if (c == NULL) {
+    c = malloc(sizeof(*c) + pool->size);
+    if (c == NULL) return NULL;
+  }
+  c->len = 0;
+  c->refs = 1;
+  return c;
+}
+
+static void chunk_put(chunk_pool_t *pool, chunk_t *c) {
+  if (__atomic_sub_fetch(&c->refs, 1, __ATOMIC_ACQ_REL) != 0) return;
+  pthread_mutex_lock(&pool->lock);
+  c->next = pool->free;
+  pool->free = c;
+  pthread_mutex_unlock(&pool->lock);
+}
+
+// One output in async mode: a thread writing from a bounded queue of
+// chunks, so a slow output only holds up the others when its queue is
+// full and the policy is to block.
+typedef struct {
+  output_t *out;
+  pthread_t thread;
+  chunk_pool_t *pool;
+
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  pthread_cond_t space;
+  chunk_t **queue;
+  size_t cap;
+  size_t head;
+  size_t count;
+  bool closing;
+  bool detached;
+
+  uint64_t queued_bytes;
+  uint64_t dropped;
+  uint64_t dropped_bytes;
+} writer_t;
+
+// Called with w->lock held.
+static void writer_discard(writer_t *w) {
+  while (w->count > 0) {
+    chunk_t *c = w->queue[w->head];
+    w->head = (w->head + 1) % w->cap;
+    w->count--;
+    chunk_put(w->pool, c);
+  }
+  w->queued_bytes = 0;
+  pthread_cond_broadcast(&w->space);
+}
+
+static void *writer_main(void *arg) {
+  writer_t *w = arg;
+  pthread_mutex_lock(&w->lock);
+  for (;;) {
+    while (w->count == 0 && !w->closing) pthread_cond_wait(&w->ready, &w->lock);
+    if (w->count == 0) break;
+    chunk_t *c = w->queue[w->head];
+    w->head = (w->head + 1) % w->cap;
+    w->count--;
+    w->queued_bytes -= c->len;
+    pthread_cond_signal(&w->space);
+    pthread_mutex_unlock(&w->lock);
+
+    size_t len = c->len;
+    int rc = write_all(w->out->fd, c->data, len);
+    int err = errno;
+    chunk_put(w->pool, c);
+
+    pthread_mutex_lock(&w->lock);
+    if (rc < 0) {
+      output_fail(w->out, err);
+      writer_discard(w);
+      break;
     }
+    w->out->written += len;
   }
+  pthread_mutex_unlock(&w->lock);
+  return NULL;
+}
+
+static void writer_push(writer_t *w, chunk_t *c, full_policy_e policy) {
+  pthread_mutex_lock(&w->lock);
+  while (w->count == w->cap && !w->out->dead && !w->detached) {
+    if (policy == FULL_DROP) {
+      w->dropped++;
+      w->dropped_bytes += c->len;
+      break;
+    }
+    if (policy == FULL_DETACH) {
+      w->detached = true;
+      w->closing = true;
+      writer_discard(w);
+      pthread_cond_signal(&w->ready);
+      break;
+    }
+    pthread_cond_wait(&w->space, &w->lock);
+  }
+  if (w->count == w->cap || w->out->dead || w->detached) {
+    pthread_mutex_unlock(&w->lock);
+    chunk_put(w->pool, c);
+    return;
+  }
+  w->queue[(w->head + w->count) % w->cap] = c;
+  w->count++;
+  w->queued_bytes += c->len;
+  pthread_cond_signal(&w->ready);
+  pthread_mutex_unlock(&w->lock);
+}
+
+static void writer_stats(writer_t *writers, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    writer_t *w = &writers[i];
+    pthread_mutex_lock(&w->lock);
+    dprintf(STDERR_FILENO,
+            "tee: %s: %ju bytes written, %zu chunks (%ju bytes) queued, %ju chunks (%ju bytes) "
+            "dropped%s\n",
+            w->out->name, (uintmax_t)w->out->written, w->count, (uintmax_t)w->queued_bytes,
+            (uintmax_t)w->dropped, (uintmax_t)w->dropped_bytes,
+            w->out->dead ? ", failed" : (w->detached ? ", detached" : ""));
+    pthread_mutex_unlock(&w->lock);
+  }
+}
+
+// Prints per-output lag whenever SIGUSR1 arrives. It has a thread of its
+// own and the signal is blocked in every other one, so the report still
+// comes out while the reader is stuck waiting on a full queue.
+typedef struct {
+  writer_t *writers;
+  size_t count;
+  sigset_t set;
+  bool stop;
+} stats_thread_t;
+
+static void *stats_main(void *arg) {
+  stats_thread_t *st = arg;
+  for (;;) {
+    int sig;
+    if (sigwait(&st->set, &sig) != 0) break;
+    if (__atomic_load_n(&st->stop, __ATOMIC_ACQUIRE)) break;
+    writer_stats(st->writers, st->count);
+  }
+  return NULL;
+}
+
+// Async mode: stdin is read into pooled chunks and handed to one writer
+// thread per output, each with a queue of depth chunks. policy decides
+// what happens when a queue is full. SIGUSR1 prints per-output lag.
+// Reading stops once no output is left to write to.
+static int async_copy(int infd, output_t *outs, size_t outfd_count, size_t depth,
+                      full_policy_e policy) {
+  // blocked before any thread starts, so they all inherit it
+  sigset_t usr1;
+  sigemptyset(&usr1);
+  sigaddset(&usr1, SIGUSR1);
+  pthread_sigmask(SIG_BLOCK, &usr1, NULL);
+
+  chunk_pool_t pool = {.size = iobuf_size(infd, outs[0].fd)};
+  pthread_mutex_init(&pool.lock, NULL);
+  writer_t *writers = calloc(outfd_count, sizeof(*writers));
+  if (writers == NULL) return -1;
+
+  int rc = 0;
+  size_t started = 0;
+  for (; started < outfd_count; started++) {
+    writer_t *w = &writers[started];
+    w->out = &outs[started];
+    w->pool = &pool;
+    w->cap = depth;
+    w->queue = calloc(depth, sizeof(*w->queue));
+    if (w->queue == NULL) {
+      rc = -1;
+      break;
+    }
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->ready, NULL);
+    pthread_cond_init(&w->space, NULL);
+    int err = pthread_create(&w->thread, NULL, writer_main, w);
+    if (err != 0) {
+      free(w->queue);
+      errno = err;
+      rc = -1;
+      break;
+    }
+  }
+  stats_thread_t stats = {.writers = writers, .count = started, .set = usr1};
+  pthread_t stats_thread;
+  bool stats_on = rc == 0 && pthread_create(&stats_thread, NULL, stats_main, &stats) == 0;
+
+  while (rc == 0) {
+    chunk_t *c = chunk_get(&pool);
+    if (c == NULL) {
+      rc = -1;
+      break;
+    }
+    ssize_t n = read(infd, c->data, pool.size);
+    if (n <= 0) {
+      chunk_put(&pool, c);
+      if (n < 0 && errno == EINTR) continue;
+      if (n < 0) rc = -1;
+      break;
+    }
+    c->len = (size_t)n;
+    c->refs = (int)started;
+    bool live = false;
+    for (size_t i = 0; i < started; i++) {
+      writer_t *w = &writers[i];
+      writer_push(w, c, policy);
+      pthread_mutex_lock(&w->lock);
+      if (!w->out->dead && !w->detached) live = true;
+      pthread_mutex_unlock(&w->lock);
+    }
+    if (!live) break;
+  }
+  int saved = errno;
+  if (stats_on) {
+    __atomic_store_n(&stats.stop, true, __ATOMIC_RELEASE);
+    pthread_kill(stats_thread, SIGUSR1);
+    pthread_join(stats_thread, NULL);
+  }
+
+  // a detached writer may be stuck in write(2) forever, so it is left
+  // running and its state is never freed
+  bool leaked = false;
+  for (size_t i = 0; i < started; i++) {
+    writer_t *w = &writers[i];
+    pthread_mutex_lock(&w->lock);
+    w->closing = true;
+    bool detached = w->detached;
+    pthread_cond_signal(&w->ready);
+    pthread_mutex_unlock(&w->lock);
+    if (detached) {
+      pthread_detach(w->thread);
+      leaked = true;
+      continue;
+    }
+    pthread_join(w->thread, NULL);
+    pthread_cond_destroy(&w->space);
+    pthread_cond_destroy(&w->ready);
+    pthread_mutex_destroy(&w->lock);
+    free(w->queue);
+  }
+  if (!leaked) {
+    while (pool.free != NULL) {
+      chunk_t *c = pool.free;
+      pool.free = c->next;
+      free(c);
+    }
+    pthread_mutex_destroy(&pool.lock);
+    free(writers);
+  }
+  errno = saved;
+  return rc;
+}
+
+// write_all for a rotated output: an expired file is rotated before
+// anything new goes into it, and a write that would take the file past
+// max_bytes is split so every generation holds at most max_bytes.
+static int output_write(output_t *o, const uint8_t *p, size_t len) {
+  rotator_t *rot = o->rot;
+  if (rot->interval > 0 && output_expired(o, now_seconds()) && output_rotate(o) < 0) return -1;
+  while (len > 0) {
+    size_t part = len;
+    if (rot->max_bytes > 0) {
+      if (o->gen_bytes >= rot->max_bytes && output_rotate(o) < 0) return -1;
+      uint64_t room = rot->max_bytes - o->gen_bytes;
+      if (part > room) part = (size_t)room;
+    }
+    if (write_all(o->fd, p, part) < 0) return -1;
+    o->written += (uint64_t)part;
+    o->gen_bytes += (uint64_t)part;
+    p += part;
+    len -= part;
+  }
+  return 0;
+}
+
+// Rotates the outputs whose interval ran out while no input came in and
+// returns the milliseconds until the next one is due, or -1 if no output
+// rotates on time.
+static int outputs_tick(output_t *outs, size_t count) {
+  int timeout = -1;
+  double now = now_seconds();
+  for (size_t i = 0; i < count; i++) {
+    output_t *o = &outs[i];
+    if (o->dead || o->rot == NULL || o->rot->interval <= 0) continue;
+    if (output_expired(o, now) && output_rotate(o) < 0) {
+      output_fail(o, errno);
+      continue;
+    }
+    double left = o->gen_started + o->rot->interval - now;
+    int ms = left < INT_MAX / 1000 ? (int)(left * 1000 + 0.999) : INT_MAX;
+    if (ms < 0) ms = 0;
+    if (timeout < 0 || ms < timeout) timeout = ms;
+  }
+  return timeout;
+}
+
+static int stream_copy(int infd, output_t *outs, size_t outfd_count) {
+  iobuf_t b;
+  if (iobuf_alloc(&b, iobuf_size(infd, outs[0].fd)) < 0) return -1;
+
+  // rotation has to see every write, so it keeps to the plain loop
+  bool kernel = !outputs_rotate(outs, outfd_count);
+  int rc = 0;
+#ifdef __linux__
+  rc = kernel ? fanout_copy(infd, outs, outfd_count, &b) : 1;
+  if (rc <= 0) {
+    int saved = errno;
+    iobuf_free(&b);
+    errno = saved;
+    return rc;
+  }
+  rc = 0;
+#endif
+#ifdef HAVE_IO_URING
+  iobuf_t bufs[2] = {b, {0}};
+  if (kernel && outputs_live(outs, outfd_count) && iobuf_alloc(&bufs[1], b.len) == 0) {
+    rc = uring_copy(infd, outs, outfd_count, bufs);
+    int saved = errno;
+    iobuf_free(&bufs[1]);
+    if (rc <= 0) {
+      iobuf_free(&b);
+      errno = saved;
+      return rc;
+    }
+    rc = 0;
+  }
+#endif
+  while (outputs_live(outs, outfd_count)) {
+    if (!kernel) {
+      // wake up for the next timed rotation even when stdin is idle
+      int timeout = outputs_tick(outs, outfd_count);
+      struct pollfd pfd = {.fd = infd, .events = POLLIN};
+      int ready = timeout >= 0 ? poll(&pfd, 1, timeout) : 1;
+      if (ready == 0 || (ready < 0 && errno == EINTR)) continue;
+      if (ready < 0) {
+        rc = -1;
+        break;
+      }
+    }
+    ssize_t n = read(infd, b.p, b.len);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      rc = -1;
+      break;
+    }
+    if (n == 0) break;
+    for (size_t i = 0; i < outfd_count; i++) {
+      output_t *o = &outs[i];
+      if (o->dead) continue;
+      if (o->rot != NULL) {
+        if (output_write(o, b.p, (size_t)n) < 0) output_fail(o, errno);
+      } else if (write_all(o->fd, b.p, (size_t)n) < 0) {
+        output_fail(o, errno);
+      } else {
+        o->written += (uint64_t)n;
+      }
+    }
+  }
+
+  int saved = errno;
+  iobuf_free(&b);
+  errno = saved;
+  return rc;
 }
 
 int main(int argc, char **argv) {
   int opt;
   bool opt_a = false;
   bool opt_i = false;
-  (void)opt_i; // currently unused
-  while ((opt = getopt(argc, argv, "ai")) != -1) {
+  size_t depth = 0;
+  full_policy_e policy = FULL_BLOCK;
+  rotator_t rot = {.progname = argv[0], .keep = ROTATE_KEEP_DEFAULT};
+  while ((opt = getopt(argc, argv, "aizC:K:P:Q:T:")) != -1) {
     switch (opt) {
     case 'a':
       opt_a = true;
@@ -76,40 +1263,152 @@ int main(int argc, char **argv) {
     case 'i':
       opt_i = true;
       break;
+    case 'Q': {
+      char *end = NULL;
+      errno = 0;
+      unsigned long long v = strtoull(optarg, &end, 10);
+      if (end == optarg || *end != '\0' || errno == ERANGE || v == 0 || v > 1u << 20) {
+        dprintf(STDERR_FILENO, "%s: invalid queue depth -- %s\n", argv[0], optarg);
+        exit(2);
+      }
+      depth = (size_t)v;
+      break;
+    }
+    case 'P':
+      if (strcmp(optarg, "block") == 0) {
+        policy = FULL_BLOCK;
+      } else if (strcmp(optarg, "drop") == 0) {
+        policy = FULL_DROP;
+      } else if (strcmp(optarg, "detach") == 0) {
+        policy = FULL_DETACH;
+      } else {
+        dprintf(STDERR_FILENO, "%s: invalid queue policy -- %s\n", argv[0], optarg);
+        exit(2);
+      }
+      if (depth == 0) depth = ASYNC_DEPTH_DEFAULT;
+      break;
+    case 'C': {
+      char *end = NULL;
+      errno = 0;
+      unsigned long long v = strtoull(optarg, &end, 10);
+      unsigned shift = 0;
+      if (*end == 'k' || *end == 'K') {
+        shift = 10;
+      } else if (*end == 'm' || *end == 'M') {
+        shift = 20;
+      } else if (*end == 'g' || *end == 'G') {
+        shift = 30;
+      }
+      if (shift > 0) end++;
+      if (end == optarg || *end != '\0' || errno == ERANGE || v == 0 || v > (UINT64_MAX >> shift)) {
+        dprintf(STDERR_FILENO, "%s: invalid rotation size -- %s\n", argv[0], optarg);
+        exit(2);
+      }
+      rot.max_bytes = (uint64_t)v << shift;
+      break;
+    }
+    case 'T': {
+      char *end = NULL;
+      errno = 0;
+      double interval = strtod(optarg, &end);
+      if (end == optarg || *end != '\0' || errno == ERANGE || !(interval > 0)) {
+        dprintf(STDERR_FILENO, "%s: invalid rotation interval -- %s\n", argv[0], optarg);
+        exit(2);
+      }
+      rot.interval = interval;
+      break;
+    }
+    case 'K': {
+      char *end = NULL;
+      errno = 0;
+      unsigned long v = strtoul(optarg, &end, 10);
+      if (end == optarg || *end != '\0' || errno == ERANGE || v > 1000) {
+        dprintf(STDERR_FILENO, "%s: invalid generation count -- %s\n", argv[0], optarg);
+        exit(2);
+      }
+      rot.keep = (unsigned)v;
+      break;
+    }
+    case 'z':
+      rot.compress = true;
+      break;
     default:
       usage(argv[0]);
     }
   }
 
-  if (opt_i) {
-    ignore_sigint();
+  bool rotating = rot.max_bytes > 0 || rot.interval > 0;
+  if (rotating && depth > 0) {
+    dprintf(STDERR_FILENO, "%s: -C and -T cannot be used with -Q or -P\n", argv[0]);
+    exit(2);
   }
 
+  if (opt_i) ignore_signal(SIGINT);
+  // a reader going away only drops that output, see output_fail
+  ignore_signal(SIGPIPE);
+
   size_t files_specified = (size_t)(argc - optind);
-  size_t outfd_count = files_specified + 1; // +1 for stdout
-  int *outfds = malloc(sizeof(int) * outfd_count);
-  if (outfds == NULL) error_errno(argv[0], "malloc");
-  outfds[0] = STDOUT_FILENO;
+  output_t *outs = calloc(files_specified + 1, sizeof(*outs)); // +1 for stdout
+  if (outs == NULL) error_errno(argv[0], "malloc");
+  outs[0] = (output_t){.fd = STDOUT_FILENO, .name = "stdout"};
+  size_t outfd_count = 1;
   int flags = O_WRONLY | O_CREAT;
+  rot.open_flags = flags | (opt_a ? O_APPEND : 0);
   if (opt_a) {
     flags |= O_APPEND;
   } else {
     flags |= O_TRUNC;
   }
+  if (rotating && rotator_start(&rot) < 0) error_errno(argv[0], "pthread_create");
 
+  int exit_code = 0;
   for (size_t i = 0; i < files_specified; i++) {
     const char *filename = argv[optind + (int)i];
     int fd = open(filename, flags, 0666);
-    if (fd < 0) error_errno(argv[0], filename);
-    outfds[i + 1] = fd;
+    if (fd < 0) {
+      dprintf(STDERR_FILENO, "%s: %s: %s\n", argv[0], filename, strerror(errno));
+      exit_code = 1;
+      continue;
+    }
+    output_t *o = &outs[outfd_count++];
+    *o = (output_t){.fd = fd, .name = filename};
+    // renaming a fifo or device node aside would replace it with a file
+    struct stat st;
+    if (rotating && (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))) {
+      dprintf(STDERR_FILENO, "%s: %s: not a regular file, not rotating\n", argv[0], filename);
+    } else if (rotating) {
+      o->rot = &rot;
+      o->gen_bytes = (uint64_t)st.st_size;
+      o->gen_started = now_seconds();
+    }
   }
 
-  int rc = stream_copy(STDIN_FILENO, outfds, outfd_count);
-  if (rc != 0) error_errno(argv[0], "read/write");
+  int rc;
+  if (depth > 0) {
+    rc = async_copy(STDIN_FILENO, outs, outfd_count, depth, policy);
+  } else {
+    rc = stream_copy(STDIN_FILENO, outs, outfd_count);
+  }
+  if (rc != 0) error_errno(argv[0], "stdin");
 
-  for (size_t i = 0; i < files_specified; i++) {
-    close(outfds[i + 1]);
+  bool failed = false;
+  for (size_t i = 1; i < outfd_count; i++) {
+    if (outs[i].fd >= 0 && close(outs[i].fd) < 0 && !outs[i].dead) output_fail(&outs[i], errno);
   }
-  free(outfds);
-  return 0;
+  if (rotating) rotator_stop(&rot);
+  for (size_t i = 0; i < outfd_count; i++) {
+    if (outs[i].dead && outs[i].err != EPIPE) failed = true;
+  }
+  // a reader that went away (EPIPE) is not an error on its own
+  if (failed) {
+    for (size_t i = 0; i < outfd_count; i++) {
+      output_t *o = &outs[i];
+      dprintf(STDERR_FILENO, "%s: %s: %ju bytes written%s%s\n", argv[0], o->name,
+              (uintmax_t)o->written, o->dead ? ", " : "", o->dead ? strerror(o->err) : "");
+    }
+    exit_code = 1;
+  }
+  // a detached async writer may still be running and pointing into outs
+  if (depth == 0) free(outs);
+  return exit_code;
 }